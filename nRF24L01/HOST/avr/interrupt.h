@@ -0,0 +1,15 @@
+// Host-side stand-in for <avr/interrupt.h>
+// ISR(x) becomes a plain function named after the vector, so the simulator can call it directly.
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#define ISR(vector, ...) void vector(void)
+
+#define sei()
+#define cli()
+
+// Vectors used by the library
+void PCINT2_vect(void);
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
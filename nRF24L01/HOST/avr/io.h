@@ -0,0 +1,99 @@
+// Host-side stand-in for <avr/io.h>
+// Every I/O register is a byte in HostIo[], indexed by its ATmega328p data space address,
+// so the library code can keep writing PORTx/DDRx/SPCR as it does on the target.
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t HostIo[0x100];
+
+#define _HOST_REG(address) (HostIo[address])
+
+//////////////////////////////////////////////////////////////////////////
+// Ports
+//////////////////////////////////////////////////////////////////////////
+#define PINB	_HOST_REG(0x23)
+#define DDRB	_HOST_REG(0x24)
+#define PORTB	_HOST_REG(0x25)
+#define PINC	_HOST_REG(0x26)
+#define DDRC	_HOST_REG(0x27)
+#define PORTC	_HOST_REG(0x28)
+#define PIND	_HOST_REG(0x29)
+#define DDRD	_HOST_REG(0x2A)
+#define PORTD	_HOST_REG(0x2B)
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+//////////////////////////////////////////////////////////////////////////
+// SPI
+//////////////////////////////////////////////////////////////////////////
+#define SPCR	_HOST_REG(0x4C)
+#define SPSR	_HOST_REG(0x4D)
+#define SPDR	_HOST_REG(0x4E)
+
+#define SPIE	7
+#define SPE		6
+#define DORD	5
+#define MSTR	4
+#define CPOL	3
+#define CPHA	2
+#define SPR1	1
+#define SPR0	0
+
+#define SPIF	7
+#define WCOL	6
+#define SPI2X	0
+
+//////////////////////////////////////////////////////////////////////////
+// Pin change interrupts
+//////////////////////////////////////////////////////////////////////////
+#define PCICR	_HOST_REG(0x68)
+#define PCMSK0	_HOST_REG(0x6B)
+#define PCMSK1	_HOST_REG(0x6C)
+#define PCMSK2	_HOST_REG(0x6D)
+
+#define PCIE0	0
+#define PCIE1	1
+#define PCIE2	2
+
+#define PCINT16 0
+#define PCINT17 1
+#define PCINT18 2
+#define PCINT19 3
+#define PCINT20 4
+#define PCINT21 5
+#define PCINT22 6
+#define PCINT23 7
+
+//////////////////////////////////////////////////////////////////////////
+// Status register
+//////////////////////////////////////////////////////////////////////////
+#define SREG	_HOST_REG(0x5F)
+
+#endif /* HOST_AVR_IO_H_ */
@@ -0,0 +1,20 @@
+// Host-side stand-in for <avr/pgmspace.h>
+// There is only one address space on the host, so flash accessors are plain reads.
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+
+#define memcpy_P(destination, source, length) memcpy(destination, source, length)
+#define strlen_P(s) strlen(s)
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
@@ -0,0 +1,2233 @@
+// SPI transaction budget of the public radio API, measured against the simulated device.
+// Build (from nRF24L01 directory):
+//   gcc -I. -IHOST -o bench HOST/bench.c NRF/nrf24.c NRF/SPI/spi.c NRF/SIM/nrfsim.c NRF/FRAG/frag.c NRF/LINK/link.c NRF/LPL/lpl.c NRF/HUB/hub.c NRF/NET/net.c NRF/SCAN/scan.c NRF/HOP/hop.c NRF/ADAPT/adapt.c HOST/hostio.c
+// Build with -DSOFT_SPI=1 to run the bit-banged soft SPI against the simulator (its bus time is the
+// SOFT_SPI_CYCLES_PER_BYTE estimate), with -DSPI_CLOCK_DIV=2 for the fastest hardware SPI.
+// Usage:
+//   bench                  - prints CSV: name,csn_frames,spi_bytes,bus_us,elapsed_us,air_us,cycles_per_byte,kbps
+//   bench HOST/budget.csv  - same, and exits with 1 if any row exceeds its budget (name,csn_frames,spi_bytes)
+// The budget depends on the SPI clock, use HOST/budget-div2.csv with -DSPI_CLOCK_DIV=2.
+
+#include "../Common/Common.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../NRF/SPI/spi.h"
+#include "../NRF/nrf24.h"
+#include "../NRF/NrfMemoryMap.h"
+#include "../NRF/FRAG/frag.h"
+#include "../NRF/LINK/link.h"
+#include "../NRF/LPL/lpl.h"
+#include "../NRF/HUB/hub.h"
+#include "../NRF/NET/net.h"
+#include "../NRF/SCAN/scan.h"
+#include "../NRF/HOP/hop.h"
+#include "../NRF/ADAPT/adapt.h"
+
+#define MAX_RESULTS 96
+
+// Payloads sent by the throughput scenarios
+#define THROUGHPUT_PACKETS 96
+
+// Main loop iteration between RADIO_EVENT() calls
+#define LOOP_US 10
+
+typedef struct
+{
+	char name[40];
+	uint32_t csnFrames;
+	uint32_t spiBytes;
+	uint64_t busNs;
+	uint64_t elapsedNs;
+	uint64_t airNs;
+	uint32_t payloadBytes;
+} Result;
+
+static Result Results[MAX_RESULTS];
+static uint8_t ResultCount = 0;
+
+static NrfSimDevice* Radio;
+static NrfSimDevice* Peer;
+
+static uint8_t Payload[MAXIMUM_PAYLOAD_SIZE];
+
+// Binary payload (with zeros) kept in flash
+static const uint8_t FlashPayload[MAXIMUM_PAYLOAD_SIZE] PROGMEM =
+{
+	0x00, 0x01, 0x02, 0x03, 0x00, 0xFF, 0x10, 0x20, 0x00, 0x00, 0x7F, 0x80, 0x55, 0xAA, 0x00, 0x01,
+	0x00, 0x01, 0x02, 0x03, 0x00, 0xFF, 0x10, 0x20, 0x00, 0x00, 0x7F, 0x80, 0x55, 0xAA, 0x00, 0x01,
+};
+
+// Second profile to measure switching configurations at runtime
+static const RadioConfigImage AlternativeConfig PROGMEM =
+{
+	.txAddress = "NODE2",
+	.rxAddressP0 = "NODE2",
+	.rxAddressP1 = { 0xC2, 0xC2, 0xC2, 0xC2, 0xC2 },
+	.rxAddressLsb = { 0xC3, 0xC4, 0xC5, 0xC6 },
+	.addressWidth = AW_BYTES_5,
+	.enabledPipes = (1<<ERX_P0),
+	.autoAck = (1<<ENAA_P0),
+	.dynamicPayload = (1<<DPL_P0),
+	.feature = (1<<EN_DPL),
+	.config = (1<<EN_CRC) | (1<<CRCO),
+	.retransmission = ARD_US_500 | ARC_5,
+	.channel = 76,
+	.rfSetup = MBPS_1 | POWER_DBM_0,
+};
+
+// Snapshot taken by Begin() and consumed by End()
+static uint64_t StartNs;
+
+// Set by throughput scenarios before End(), payload bytes the peer has received
+static uint32_t DeliveredBytes = 0;
+
+// Message for the fragmentation scenarios
+static uint8_t Block[1024];
+
+// Length of the last message reassembled correctly, 0 if it didn't match Block
+static uint16_t Reassembled;
+
+// Payloads left for the stream source
+static uint8_t StreamLeft;
+
+// Link receiver scripted on the other end of the air
+static uint8_t PeerExpected;
+static uint16_t PeerReceived;
+static uint8_t PeerFrames[LINK_WINDOW];
+static NrfSimPayload PeerAck;
+static NrfSimFrame PeerLast;
+static uint16_t PeerDelivered;
+static uint8_t PeerInOrder;
+
+// Frames the radio delivered through the link, in order
+static uint8_t LinkOrder[8];
+static uint8_t LinkOrderCount;
+
+// Behaviour checks that didn't come out as expected, any of them fails the run
+static uint16_t Failures = 0;
+
+// Driver state, to know when a transmission is over
+extern volatile uint8_t State;
+extern volatile uint8_t TransmissionInProgress;
+
+//////////////////////////////////////////////////////////////////////////
+// Driver's debug output goes to stderr so it doesn't break the CSV
+//////////////////////////////////////////////////////////////////////////
+void uart_puts(char* s)
+{
+	fputs(s, stderr);
+}
+
+void uart_putc(char c)
+{
+	fputc(c, stderr);
+}
+
+void uart_putint(int value, int radix)
+{
+	fprintf(stderr, radix == 16 ? "%x" : "%d", value);
+}
+
+// Counts a behaviour check that failed, the line printed before it has the numbers
+static void Expect(uint8_t ok, const char* what)
+{
+	if (ok)
+		return;
+
+	fprintf(stderr, "FAILED: %s\n", what);
+	Failures++;
+}
+
+// Payloads delivered to the callback
+static uint32_t ReceivedCount = 0;
+
+static void DataReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	(void)data;
+	(void)length;
+	(void)pipe;
+	ReceivedCount++;
+}
+
+// Payloads delivered to pipe 1 callback, with the right length and pipe
+static uint8_t PipeReceivedCount = 0;
+
+static void PipeReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	if (pipe == DATA_PIPE_1 && length == MAXIMUM_PAYLOAD_SIZE && memcmp(data, Payload, length) == 0)
+		PipeReceivedCount++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Measurement
+//////////////////////////////////////////////////////////////////////////
+static void Begin(void)
+{
+	NrfSimResetStats(Radio);
+	StartNs = NrfSimNanos();
+}
+
+static void End(const char* name)
+{
+	if (ResultCount == MAX_RESULTS)
+		return;
+
+	Result* result = &Results[ResultCount++];
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->csnFrames = Radio->stats.csnFrames;
+	result->spiBytes = Radio->stats.spiBytes;
+	result->busNs = Radio->stats.spiTimeNs;
+	result->elapsedNs = NrfSimNanos() - StartNs;
+	result->airNs = Radio->stats.airtimeNs;
+	result->payloadBytes = DeliveredBytes;
+	DeliveredBytes = 0;
+}
+
+#define MEASURE(name, call) do { Begin(); call; End(name); } while (0)
+
+// Lets the simulated air traffic finish without counting it to any call
+static void Idle(uint32_t us)
+{
+	NrfSimAdvance((uint64_t)us * 1000);
+}
+
+// Runs the main loop until the device gets to the state it's been sent to (RADIO_NONBLOCKING)
+static void Settle(void)
+{
+	while (!RadioIsReady())
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+}
+
+// Sends a command to the peer
+static void PeerWrite(uint8_t command, const uint8_t* data, uint8_t length)
+{
+	NrfSimSelect(Peer);
+	NrfSimSetCSN(0);
+	NrfSimShift(command);
+	while (length--)
+		NrfSimShift(*data++);
+	NrfSimSetCSN(1);
+	NrfSimSelect(Radio);
+}
+
+// Makes the peer answer the next packet with an ACK payload
+static void PeerAckPayload(const uint8_t* data, uint8_t length)
+{
+	PeerWrite(W_ACK_PAYLOAD | DATA_PIPE_0, data, length);
+}
+
+static void PeerListen(uint8_t onOff)
+{
+	NrfSimSelect(Peer);
+	NrfSimSetCE(onOff);
+	NrfSimSelect(Radio);
+}
+
+// Frame as the radio would receive it from another node sending to address on the channel
+// ack receives the ACK payload the radio sends back, if any (can be NULL), returns 1 if the frame has been acknowledged
+static uint8_t InjectOn(uint8_t channel, const uint8_t* address, const uint8_t* data, uint8_t length, NrfSimPayload* ack)
+{
+	static uint8_t pid = 0;
+	uint8_t acked;
+
+	NrfSimFrame frame;
+	frame.channel = channel;
+	frame.rate = NrfSimPeek(Radio, RF_SETUP) & ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH));
+	memcpy(frame.address, address, 5);
+	frame.addressLength = 5;
+	frame.pid = pid++ & 0x03;
+	frame.noAck = 0;
+	frame.length = length;
+	memcpy(frame.data, data, length);
+	// Frame goes to every chip on the channel, the peer shares the address
+	PeerListen(0);
+	acked = NrfSimInject(&frame, ack);
+	PeerListen(1);
+
+	return acked;
+}
+
+// Frame on the radio's channel
+static void InjectAddressed(const uint8_t* address, const uint8_t* data, uint8_t length, NrfSimPayload* ack)
+{
+	InjectOn(NrfSimPeek(Radio, RF_CH), address, data, length, ack);
+}
+
+// Frame on the radio's pipe 0 address
+static void InjectData(const uint8_t* data, uint8_t length, NrfSimPayload* ack)
+{
+	InjectAddressed(Radio->rxAddressP0, data, length, ack);
+}
+
+static void InjectPayload(NrfSimPayload* ack)
+{
+	InjectData(Payload, MAXIMUM_PAYLOAD_SIZE, ack);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Scenarios
+//////////////////////////////////////////////////////////////////////////
+static void Setup(void)
+{
+	NrfSimReset();
+	Radio = NrfSimSelected();
+	NrfSimBindIrq(Radio, &PIN(IRQ_PORT), IRQ, PCINT2_vect);
+
+	// Receiver for everything the radio sends, configured like RadioConfig() does
+	Peer = NrfSimAddDevice();
+	NrfSimSetAddress(Peer, RX_ADDR_P0, (const uint8_t*)"TEST1");
+	NrfSimPoke(Peer, RF_CH, 50);
+	NrfSimPoke(Peer, RF_SETUP, MBPS_2 | POWER_DBM_0);
+	NrfSimPoke(Peer, DYNPD, (1<<DPL_P0));
+	NrfSimPoke(Peer, FEATURE, (1<<EN_DPL) | (1<<EN_ACK_PAY));
+	NrfSimPoke(Peer, CONFIG, (1<<EN_CRC) | (1<<PWR_UP) | (1<<PRIM_RX));
+	NrfSimSetSink(Peer, 1);
+	PeerListen(1);
+
+	for (uint8_t i = 0; i < MAXIMUM_PAYLOAD_SIZE; i++)
+		Payload[i] = 'A' + (i % 26);
+}
+
+// Registers of the device that differ from the image in flash, power and role bits aside
+static uint8_t ImageMismatches(const RadioConfigImage* flashImage)
+{
+	RadioConfigImage image;
+	memcpy_P(&image, flashImage, sizeof(image));
+
+	uint8_t width = image.addressWidth + 2;
+	uint8_t mismatches = 0;
+	mismatches += NrfSimPeek(Radio, SETUP_AW) != image.addressWidth;
+	mismatches += memcmp(Radio->txAddress, image.txAddress, width) != 0;
+	mismatches += memcmp(Radio->rxAddressP0, image.rxAddressP0, width) != 0;
+	mismatches += memcmp(Radio->rxAddressP1, image.rxAddressP1, width) != 0;
+	for (uint8_t i = 0; i < 4; i++)
+		mismatches += NrfSimPeek(Radio, RX_ADDR_P2 + i) != image.rxAddressLsb[i];
+	mismatches += NrfSimPeek(Radio, EN_RXADDR) != image.enabledPipes;
+	mismatches += NrfSimPeek(Radio, EN_AA) != image.autoAck;
+	for (uint8_t i = 0; i < 6; i++)
+		mismatches += NrfSimPeek(Radio, RX_PW_P0 + i) != image.payloadWidth[i];
+	mismatches += NrfSimPeek(Radio, DYNPD) != image.dynamicPayload;
+	mismatches += NrfSimPeek(Radio, FEATURE) != image.feature;
+	mismatches += (NrfSimPeek(Radio, CONFIG) & ~((1<<PWR_UP) | (1<<PRIM_RX))) != image.config;
+	mismatches += NrfSimPeek(Radio, SETUP_RETR) != image.retransmission;
+	mismatches += NrfSimPeek(Radio, RF_CH) != image.channel;
+	mismatches += NrfSimPeek(Radio, RF_SETUP) != image.rfSetup;
+
+	return mismatches;
+}
+
+static void Configuration(void)
+{
+	MEASURE("RadioInitialize", RadioInitialize());
+	Settle();
+	RegisterRadioCallback(DataReceived);
+
+	MEASURE("RadioConfig", RadioConfig());
+	MEASURE("RadioCommitConfig_P(unchanged)", RadioCommitConfig_P(&RadioDefaultConfig));
+	MEASURE("RadioCommitConfig_P(switch)", RadioCommitConfig_P(&AlternativeConfig));
+	uint8_t switched = ImageMismatches(&AlternativeConfig);
+	MEASURE("RadioCommitConfig_P(switch back)", RadioCommitConfig_P(&RadioDefaultConfig));
+	uint8_t switchedBack = ImageMismatches(&RadioDefaultConfig);
+	fprintf(stderr, "Config switch: %u registers off after the switch, %u after the switch back (expected 0, 0)\n",
+			switched, switchedBack);
+	Expect(switched == 0 && switchedBack == 0, "RadioCommitConfig_P() leaves the device as the image says");
+	MEASURE("RadioSetTransmitterAddress", RadioSetTransmitterAddress(PSTR("TEST1")));
+	MEASURE("RadioSetReceiverAddress", RadioSetReceiverAddress(DATA_PIPE_0, PSTR("TEST1")));
+	MEASURE("RadioConfigDataPipe", RadioConfigDataPipe(DATA_PIPE_0, 1, 1));
+	MEASURE("RadioSetDynamicPayload", RadioSetDynamicPayload(DATA_PIPE_0, 1));
+	MEASURE("RadioEnableCRC", RadioEnableCRC());
+	MEASURE("RadioSetCRCLength", RadioSetCRCLength(1));
+	MEASURE("RadioConfigRetransmission", RadioConfigRetransmission(ARD_US_4000, ARC_10));
+	MEASURE("RadioConfigureInterrupts", RadioConfigureInterrupts());
+	MEASURE("RadioSetPower", RadioSetPower(POWER_DBM_0));
+	MEASURE("RadioSetSpeed", RadioSetSpeed(MBPS_2));
+	MEASURE("RadioSetChannel", RadioSetChannel(50));
+	MEASURE("RadioSetChannel(changed)", RadioSetChannel(51));
+	RadioSetChannel(50);
+	MEASURE("RadioClearRX", RadioClearRX());
+	MEASURE("RadioClearTX", RadioClearTX());
+	MEASURE("IsReceivedDataReady", IsReceivedDataReady());
+	MEASURE("IsDataSentSuccessful", IsDataSentSuccessful());
+	MEASURE("RadioPowerUp", RadioPowerUp());
+	Settle();
+	MEASURE("RadioPowerDown", RadioPowerDown());
+}
+
+// Power down to RX mode: time the call keeps the MCU, and main loop iterations until the device listens
+static void Settling(void)
+{
+	uint32_t loops = 0;
+
+	MEASURE("RadioEnterRxMode(power down)", RadioEnterRxMode());
+	Begin();
+	while (!RadioIsReady())
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+		loops++;
+	}
+	End("Settling(power down -> RX)");
+	fprintf(stderr, "Settling: %u main loop iterations while the device powered up\n", (unsigned)loops);
+	#if RADIO_NONBLOCKING != 0
+	Expect(loops > 0, "main loop runs while the device settles");
+	#endif
+
+	// Back to where Transmitter() expects the device
+	RadioEnterTxMode();
+	RadioPowerDown();
+}
+
+// Payload upload the way it was done before block transfers, for comparison
+static void ShiftLoopUpload(void)
+{
+	CSN_LOW;
+	SpiShift(W_TX_PAYLOAD);
+	for (uint8_t i = 0; i < MAXIMUM_PAYLOAD_SIZE; i++)
+		SpiShift(Payload[i]);
+	CSN_HIGH;
+}
+
+static void Transmitter(void)
+{
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE + 1];
+
+	MEASURE("RadioEnterTxMode", RadioEnterTxMode());
+	Settle();
+
+	// CE is low, payloads stay in TX FIFO
+	MEASURE("W_TX_PAYLOAD(SpiShift loop)", ShiftLoopUpload());
+	RadioClearTX();
+	MEASURE("RadioLoadPayload", RadioLoadPayload(Payload, MAXIMUM_PAYLOAD_SIZE));
+	RadioClearTX();
+
+	memcpy(data, Payload, MAXIMUM_PAYLOAD_SIZE);
+	data[MAXIMUM_PAYLOAD_SIZE] = '\0';
+	MEASURE("RadioSend", RadioSend(data));
+	Idle(5000);
+	MEASURE("RADIO_EVENT(TX_DS)", RADIO_EVENT());
+
+	// Binary payloads - zeros don't cut them short, the peer keeps them to be compared
+	uint8_t binary[MAXIMUM_PAYLOAD_SIZE];
+	uint8_t expected[MAXIMUM_PAYLOAD_SIZE];
+	memcpy_P(binary, FlashPayload, MAXIMUM_PAYLOAD_SIZE);
+	memcpy(expected, binary, MAXIMUM_PAYLOAD_SIZE);
+	NrfSimSetSink(Peer, 0);
+	MEASURE("RadioSendBuffer", RadioSendBuffer(binary, MAXIMUM_PAYLOAD_SIZE));
+	Idle(5000);
+	RADIO_EVENT();
+	MEASURE("RadioSendBuffer_P", RadioSendBuffer_P(FlashPayload, MAXIMUM_PAYLOAD_SIZE));
+	Idle(5000);
+	RADIO_EVENT();
+	uint8_t intact = Peer->rxCount == 2;
+	for (uint8_t i = 0; i < Peer->rxCount; i++)
+		intact = intact && Peer->rxFifo[i].length == MAXIMUM_PAYLOAD_SIZE &&
+				 memcmp(Peer->rxFifo[i].data, expected, MAXIMUM_PAYLOAD_SIZE) == 0;
+	uint8_t untouched = memcmp(binary, expected, MAXIMUM_PAYLOAD_SIZE) == 0;
+	PeerWrite(FLUSH_RX, NULL, 0);
+	NrfSimSetSink(Peer, 1);
+	fprintf(stderr, "Binary payloads: %s at the peer, source %s (expected intact, untouched)\n",
+			intact ? "intact" : "corrupted", untouched ? "untouched" : "modified");
+	Expect(intact, "RadioSendBuffer() and RadioSendBuffer_P() deliver binary data intact");
+	Expect(untouched, "RadioSendBuffer() leaves the source buffer alone");
+
+	// Nobody listens - transmission ends with MAX_RT
+	PeerListen(0);
+	memcpy(data, Payload, MAXIMUM_PAYLOAD_SIZE);
+	RadioSend(data);
+	Idle(100000);
+	MEASURE("RADIO_EVENT(MAX_RT)", RADIO_EVENT());
+	PeerListen(1);
+}
+
+// One payload after another with RadioSend(), waiting for each TX_DS
+static void SendEach(void)
+{
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE + 1];
+
+	for (uint8_t i = 0; i < THROUGHPUT_PACKETS; i++)
+	{
+		memcpy(data, Payload, MAXIMUM_PAYLOAD_SIZE);
+		data[MAXIMUM_PAYLOAD_SIZE] = '\0';
+		RadioSend(data);
+
+		while (TransmissionInProgress)
+		{
+			Idle(LOOP_US);
+			RADIO_EVENT();
+		}
+	}
+}
+
+// Same payloads without ACKs
+static void SendEachNoAck(void)
+{
+	for (uint8_t i = 0; i < THROUGHPUT_PACKETS; i++)
+	{
+		RadioSendBufferNoAck(Payload, MAXIMUM_PAYLOAD_SIZE);
+
+		while (TransmissionInProgress)
+		{
+			Idle(LOOP_US);
+			RADIO_EVENT();
+		}
+	}
+}
+
+static uint8_t StreamSource(uint8_t* buffer)
+{
+	if (StreamLeft == 0)
+		return 0;
+
+	StreamLeft--;
+	memcpy(buffer, Payload, MAXIMUM_PAYLOAD_SIZE);
+	return MAXIMUM_PAYLOAD_SIZE;
+}
+
+// Same payloads through the Standby-II stream
+static void Stream(void)
+{
+	StreamLeft = THROUGHPUT_PACKETS;
+	RadioStreamBegin(StreamSource);
+
+	while (State == STANDBY_2)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+
+		if (StreamLeft == 0)
+			RadioStreamEnd();
+	}
+}
+
+// Same payloads pushed into the TX queue as fast as it takes them
+static void Enqueue(void)
+{
+	for (uint8_t i = 0; i < THROUGHPUT_PACKETS; i++)
+	{
+		while (RadioEnqueue(Payload, MAXIMUM_PAYLOAD_SIZE) == QUEUE_FULL)
+		{
+			Idle(LOOP_US);
+			RADIO_EVENT();
+		}
+	}
+
+	while (State != STANDBY_1)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+}
+
+static void Throughput(void)
+{
+	uint32_t received;
+
+	RadioEnterTxMode();
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	SendEach();
+	DeliveredBytes = (Peer->stats.rxPackets - received) * MAXIMUM_PAYLOAD_SIZE;
+	End("Throughput(RadioSend x96)");
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	SendEachNoAck();
+	DeliveredBytes = (Peer->stats.rxPackets - received) * MAXIMUM_PAYLOAD_SIZE;
+	End("Throughput(RadioSendBufferNoAck x96)");
+
+	// Retransmissions on a lossy link, ACK-less packets are just lost
+	NrfSimSetLoss(100, 0);
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	SendEach();
+	DeliveredBytes = (Peer->stats.rxPackets - received) * MAXIMUM_PAYLOAD_SIZE;
+	End("Throughput(RadioSend x96, 10% loss)");
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	SendEachNoAck();
+	DeliveredBytes = (Peer->stats.rxPackets - received) * MAXIMUM_PAYLOAD_SIZE;
+	End("Throughput(NoAck x96, 10% loss)");
+
+	NrfSimSetLoss(0, 0);
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	Stream();
+	DeliveredBytes = (Peer->stats.rxPackets - received) * MAXIMUM_PAYLOAD_SIZE;
+	End("Throughput(RadioStream x96)");
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	Enqueue();
+	DeliveredBytes = (Peer->stats.rxPackets - received) * MAXIMUM_PAYLOAD_SIZE;
+	End("Throughput(RadioEnqueue x96)");
+
+	// Burst during a transmission - nothing accepted may be lost
+	uint8_t accepted = 0;
+	received = Peer->stats.rxPackets;
+	MEASURE("RadioEnqueue", accepted += RadioEnqueue(Payload, MAXIMUM_PAYLOAD_SIZE));
+	while (RadioEnqueue(Payload, MAXIMUM_PAYLOAD_SIZE) == QUEUE_OK)
+		accepted++;
+	MEASURE("RadioEnqueue(full)", RadioEnqueue(Payload, MAXIMUM_PAYLOAD_SIZE));
+	while (State != STANDBY_1)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+	fprintf(stderr, "Queue burst: %u/%u delivered, high watermark %u\n",
+			(unsigned)(Peer->stats.rxPackets - received), accepted, RadioQueueHighWatermark());
+	Expect(accepted > 0 && Peer->stats.rxPackets - received == accepted, "queue burst delivers everything accepted");
+}
+
+static void Receiver(void)
+{
+	MEASURE("RadioEnterRxMode", RadioEnterRxMode());
+	Settle();
+
+	InjectPayload(NULL);
+	MEASURE("RADIO_EVENT(RX_DR)", RADIO_EVENT());
+
+	uint8_t pipe;
+	InjectPayload(NULL);
+	MEASURE("RadioReadData", RadioReadData(&pipe));
+	RADIO_EVENT();
+
+	// Full RX FIFO - every payload has to be delivered
+	uint32_t received = ReceivedCount;
+	InjectPayload(NULL);
+	InjectPayload(NULL);
+	InjectPayload(NULL);
+	MEASURE("RADIO_EVENT(RX_DR x3)", RADIO_EVENT());
+	fprintf(stderr, "RX drain: %u/3 delivered\n", (unsigned)(ReceivedCount - received));
+	Expect(ReceivedCount - received == 3, "full RX FIFO drained in one RADIO_EVENT()");
+
+	// Slow consumer - payloads are kept in slots and RX FIFO until released
+	RadioRxSlot* slot;
+	uint8_t lent = 0;
+	RegisterRadioCallback(NULL);
+	for (uint8_t i = 0; i < 6; i++)
+	{
+		InjectPayload(NULL);
+		if (i % 3 == 2)
+			RADIO_EVENT();
+	}
+	MEASURE("RadioBorrowSlot", slot = RadioBorrowSlot());
+	while (slot)
+	{
+		lent++;
+		RadioReleaseSlot(slot);
+		RADIO_EVENT();
+		slot = RadioBorrowSlot();
+	}
+	fprintf(stderr, "RX slots: %u/6 delivered\n", lent);
+	Expect(lent == 6, "slow consumer gets every payload");
+	RegisterRadioCallback(DataReceived);
+
+	// Fixed size pipe with its own callback - no R_RX_PL_WID, no payload parsing to route it
+	RadioConfigDataPipe(DATA_PIPE_1, 1, 1);
+	MEASURE("RadioSetStaticPayloadWidth", RadioSetStaticPayloadWidth(DATA_PIPE_1, MAXIMUM_PAYLOAD_SIZE));
+	RegisterPipeCallback(DATA_PIPE_1, PipeReceived);
+	received = ReceivedCount;
+	InjectAddressed(Radio->rxAddressP1, Payload, MAXIMUM_PAYLOAD_SIZE, NULL);
+	MEASURE("RADIO_EVENT(RX_DR static)", RADIO_EVENT());
+	InjectAddressed(Radio->rxAddressP1, Payload, MAXIMUM_PAYLOAD_SIZE, NULL);
+	InjectPayload(NULL);
+	InjectAddressed(Radio->rxAddressP1, Payload, MAXIMUM_PAYLOAD_SIZE, NULL);
+	MEASURE("RADIO_EVENT(RX_DR x3 mixed)", RADIO_EVENT());
+	fprintf(stderr, "Pipe dispatch: %u/3 on pipe 1, %u/1 on the rest\n", PipeReceivedCount, (unsigned)(ReceivedCount - received));
+	Expect(PipeReceivedCount == 3 && ReceivedCount - received == 1, "payloads go to their pipe's callback");
+	RegisterPipeCallback(DATA_PIPE_1, NULL);
+	RadioConfigDataPipe(DATA_PIPE_1, 0, 0);
+
+	MEASURE("RADIO_EVENT(idle)", RADIO_EVENT());
+}
+
+// Waits for the end of a RadioSend() and handles it
+static void WaitSent(void)
+{
+	while (TransmissionInProgress)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+}
+
+// Request and response, the response riding on the ACK or sent after switching roles
+static void AckPayloads(void)
+{
+	uint32_t received;
+	NrfSimPayload ack;
+
+	RadioSetAckPayload(1);
+
+	// Transmitter side
+	RadioEnterTxMode();
+	received = ReceivedCount;
+	PeerAckPayload(Payload, MAXIMUM_PAYLOAD_SIZE);
+	Begin();
+	RadioSendBuffer(Payload, MAXIMUM_PAYLOAD_SIZE);
+	WaitSent();
+	End("Request/response(ACK payload)");
+	fprintf(stderr, "ACK payload: %u/1 delivered\n", (unsigned)(ReceivedCount - received));
+	Expect(ReceivedCount - received == 1, "response rides on the ACK");
+
+	// The same the old way: response is a separate packet
+	Begin();
+	RadioSendBuffer(Payload, MAXIMUM_PAYLOAD_SIZE);
+	WaitSent();
+	RadioEnterRxMode();
+	Settle();
+	InjectPayload(NULL);
+	RADIO_EVENT();
+	RadioEnterTxMode();
+	End("Request/response(role switch)");
+
+	// Receiver side - queued payloads go out one per received packet
+	RadioEnterRxMode();
+	Settle();
+	MEASURE("RadioQueueAckPayload", RadioQueueAckPayload(DATA_PIPE_0, Payload, MAXIMUM_PAYLOAD_SIZE));
+	RadioQueueAckPayload(DATA_PIPE_0, Payload, 8);
+
+	uint8_t lengths[2];
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		InjectPayload(&ack);
+		lengths[i] = ack.length;
+		RADIO_EVENT();
+	}
+	fprintf(stderr, "ACK payloads sent: %u,%u (expected 32,8)\n", lengths[0], lengths[1]);
+	Expect(lengths[0] == MAXIMUM_PAYLOAD_SIZE && lengths[1] == 8, "queued ACK payloads go out in order");
+
+	RadioSetAckPayload(0);
+}
+
+static void MessageReceived(uint8_t* data, uint16_t length, uint8_t pipe)
+{
+	(void)pipe;
+	Reassembled = memcmp(data, Block, length) == 0 ? length : 0;
+}
+
+// Builds fragment number index of the length bytes long Block, returns its size
+static uint8_t BuildFragment(uint8_t* buffer, uint8_t id, uint8_t index, uint16_t length)
+{
+	uint16_t offset = index * FRAG_DATA_SIZE;
+	uint8_t size = length - offset > FRAG_DATA_SIZE ? FRAG_DATA_SIZE : length - offset;
+
+	buffer[FRAG_ID] = id;
+	buffer[FRAG_INDEX] = index | (offset + size == length ? FRAG_LAST : 0);
+	memcpy(&buffer[FRAG_HEADER_SIZE], &Block[offset], size);
+	return FRAG_HEADER_SIZE + size;
+}
+
+// 1 KB message streamed in fragments, and the same fragments sent one at a time
+static void Fragments(void)
+{
+	uint8_t fragment[MAXIMUM_PAYLOAD_SIZE];
+	uint8_t count = (sizeof(Block) + FRAG_DATA_SIZE - 1) / FRAG_DATA_SIZE;
+	uint32_t received;
+
+	for (uint16_t i = 0; i < sizeof(Block); i++)
+		Block[i] = i * 7;
+
+	RadioEnterTxMode();
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	FragSend(Block, sizeof(Block));
+	while (State != STANDBY_1)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+	DeliveredBytes = Peer->stats.rxPackets - received == count ? sizeof(Block) : 0;
+	End("Fragments(1 KB streamed)");
+
+	received = Peer->stats.rxPackets;
+	Begin();
+	for (uint8_t i = 0; i < count; i++)
+	{
+		RadioSendBuffer(fragment, BuildFragment(fragment, 0, i, sizeof(Block)));
+		WaitSent();
+	}
+	DeliveredBytes = Peer->stats.rxPackets - received == count ? sizeof(Block) : 0;
+	End("Fragments(1 KB one by one)");
+
+	// Receiving - the longest message the buffer takes, and one fragment too many
+	RadioEnterRxMode();
+	Settle();
+	RegisterRadioCallback(FragPacketReceived);
+	RegisterFragCallback(MessageReceived);
+
+	for (uint16_t length = FRAG_BUFFER_SIZE; length <= FRAG_BUFFER_SIZE + 1; length++)
+	{
+		Reassembled = 0;
+		for (uint8_t i = 0; i * FRAG_DATA_SIZE < length; i++)
+		{
+			InjectData(fragment, BuildFragment(fragment, length, i, length), NULL);
+			RADIO_EVENT();
+		}
+		fprintf(stderr, "Reassembly of %u bytes: %u\n", length, Reassembled);
+		Expect(Reassembled == (length <= FRAG_BUFFER_SIZE ? length : 0), "reassembly up to FRAG_BUFFER_SIZE only");
+	}
+
+	RegisterRadioCallback(DataReceived);
+}
+
+// Frame is delivered when its first byte matches the number of frames delivered so far
+static void PeerDeliver(uint8_t first)
+{
+	if (first != (uint8_t)PeerDelivered)
+		PeerInOrder = 0;
+	PeerDelivered++;
+}
+
+// Receiving end of the link, kept separate from the radio's own link state
+// ACK payload lags one frame behind, like on the chip where it has to be loaded before the frame comes
+static uint8_t LinkPeer(const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	*ackPayload = PeerAck;
+
+	// Retransmission of a frame the chip has already taken (its ACK got lost)
+	if (frame->pid == PeerLast.pid && frame->length == PeerLast.length &&
+		memcmp(frame->data, PeerLast.data, frame->length) == 0)
+		return 1;
+	PeerLast = *frame;
+
+	if (frame->data[0] == LINK_DATA)
+	{
+		uint8_t sequence = frame->data[1];
+		uint8_t distance = sequence - PeerExpected;
+
+		if (distance == 0)
+		{
+			PeerDeliver(frame->data[LINK_HEADER_SIZE]);
+			PeerExpected++;
+			while (PeerReceived & 1)
+			{
+				PeerDeliver(PeerFrames[PeerExpected % LINK_WINDOW]);
+				PeerExpected++;
+				PeerReceived >>= 1;
+			}
+			PeerReceived >>= 1;
+		}
+		else if (distance < LINK_WINDOW)
+		{
+			PeerFrames[sequence % LINK_WINDOW] = frame->data[LINK_HEADER_SIZE];
+			PeerReceived |= 1 << (distance - 1);
+		}
+	}
+
+	PeerAck.length = LINK_ACK_SIZE;
+	PeerAck.data[0] = LINK_ACK;
+	PeerAck.data[1] = PeerExpected;
+	PeerAck.data[2] = PeerReceived & 0xFF;
+	PeerAck.data[3] = PeerReceived >> 8;
+	return 1;
+}
+
+// Frames with their number in the first data byte, through the link until all are acknowledged
+static void LinkBulk(void)
+{
+	uint8_t frame[LINK_DATA_SIZE];
+	memcpy(frame, Payload, LINK_DATA_SIZE);
+
+	for (uint8_t i = 0; i < THROUGHPUT_PACKETS; i++)
+	{
+		frame[0] = i;
+		while (LinkSend(frame, LINK_DATA_SIZE) == QUEUE_FULL)
+		{
+			Idle(LOOP_US);
+			RADIO_EVENT();
+		}
+	}
+
+	while (LinkPending() || State != STANDBY_1)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+}
+
+static void LinkBulkMeasured(const char* name)
+{
+	PeerDelivered = 0;
+	PeerInOrder = 1;
+	Begin();
+	LinkBulk();
+	DeliveredBytes = PeerInOrder ? PeerDelivered * LINK_DATA_SIZE : 0;
+	End(name);
+	fprintf(stderr, "%s: %u/%u delivered in order %u\n", name, PeerDelivered, THROUGHPUT_PACKETS, PeerInOrder);
+	Expect(PeerDelivered == THROUGHPUT_PACKETS && PeerInOrder, "link delivers everything in order");
+}
+
+static void LinkDelivered(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	(void)length;
+	(void)pipe;
+	if (LinkOrderCount < sizeof(LinkOrder))
+		LinkOrder[LinkOrderCount++] = data[0];
+}
+
+// Injects link frame with sequence number (its first data byte too), returns the ACK payload it got
+static void InjectLinkFrame(uint8_t kind, uint8_t sequence, NrfSimPayload* ack)
+{
+	uint8_t frame[LINK_HEADER_SIZE + 1] = { kind, sequence, sequence };
+
+	InjectData(frame, kind == LINK_DATA ? sizeof(frame) : LINK_HEADER_SIZE, ack);
+	RADIO_EVENT();
+}
+
+// Bulk transfer through the reliable link, against plain streaming when the radio gives up on packets
+static void Link(void)
+{
+	uint32_t received;
+	NrfSimPayload ack;
+
+	RadioEnterTxMode();
+	LinkInitialize();
+	PeerListen(0);
+	NrfSimSetPeer(LinkPeer);
+
+	LinkBulkMeasured("Link(96 x 30 B)");
+
+	NrfSimSetLoss(100, 0);
+	LinkBulkMeasured("Link(96 x 30 B, 10% loss)");
+
+	// Hardware retransmissions alone can't make it, MAX_RT drops packets
+	NrfSimSetLoss(300, 0);
+	RadioConfigRetransmission(ARD_US_500, ARC_2);
+	LinkBulkMeasured("Link(96 x 30 B, 30% loss, ARC 2)");
+	fprintf(stderr, "Link failures: %u\n", LinkFailures());
+	Expect(LinkFailures() == 0, "link gives up on nothing");
+
+	NrfSimSetPeer(NULL);
+	PeerListen(1);
+	received = Peer->stats.rxPackets;
+	Begin();
+	Stream();
+	DeliveredBytes = (Peer->stats.rxPackets - received) * MAXIMUM_PAYLOAD_SIZE;
+	End("RadioStream(x96, 30% loss, ARC 2)");
+	fprintf(stderr, "Stream on 30%% loss: %u/%u delivered, %u dropped (expected %u together)\n",
+			(unsigned)(Peer->stats.rxPackets - received), THROUGHPUT_PACKETS, RadioStreamDropped(), THROUGHPUT_PACKETS);
+	Expect(Peer->stats.rxPackets - received + RadioStreamDropped() == THROUGHPUT_PACKETS, "stream counts every payload it drops");
+
+	NrfSimSetLoss(0, 0);
+	RadioConfigRetransmission(ARD_US_4000, ARC_10);
+
+	// Receiving end - out of order and duplicate frames, delivered in order once
+	RadioEnterRxMode();
+	Settle();
+	RegisterLinkCallback(LinkDelivered);
+	LinkOrderCount = 0;
+	InjectLinkFrame(LINK_DATA, 0, NULL);
+	InjectLinkFrame(LINK_DATA, 2, NULL);
+	InjectLinkFrame(LINK_DATA, 2, NULL);
+	InjectLinkFrame(LINK_DATA, 0, NULL);
+	Begin();
+	InjectLinkFrame(LINK_DATA, 1, NULL);
+	End("LinkPacketReceived(gap filled)");
+	InjectLinkFrame(LINK_DATA, 4, NULL);
+	InjectLinkFrame(LINK_POLL, 0, NULL);
+	InjectLinkFrame(LINK_POLL, 0, &ack);
+
+	fprintf(stderr, "Link receiver: delivered");
+	for (uint8_t i = 0; i < LinkOrderCount; i++)
+		fprintf(stderr, " %u", LinkOrder[i]);
+	fprintf(stderr, " (expected 0 1 2), ack %u/%02x%02x (expected 3/0001)\n", ack.data[1], ack.data[3], ack.data[2]);
+	Expect(LinkOrderCount == 3 && LinkOrder[0] == 0 && LinkOrder[1] == 1 && LinkOrder[2] == 2,
+		   "link receiver delivers in order, once");
+	Expect(ack.data[1] == 3 && ack.data[2] == 0x01 && ack.data[3] == 0x00, "link receiver reports the gap");
+
+	RegisterRadioCallback(DataReceived);
+	RadioSetAckPayload(0);
+}
+
+// Commands the low power scenarios send, and which of them arrived
+#define LPL_COMMANDS 16
+static uint8_t CommandsArrived[LPL_COMMANDS];
+
+static void CommandReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	(void)length;
+	(void)pipe;
+	if (data[0] < LPL_COMMANDS)
+		CommandsArrived[data[0]] = 1;
+}
+
+// Main loop of a duty-cycled node
+static void LowPowerLoop(uint32_t us)
+{
+	uint64_t end = NrfSimNanos() + (uint64_t)us * 1000;
+	while (NrfSimNanos() < end)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+		LPL_EVENT();
+	}
+}
+
+// Peer's own RX window, in step with the radio's clock
+static uint32_t PeerWindowStart;
+
+// Listener scripted on the other end of the air, acknowledges only during its windows
+static uint8_t LowPowerPeer(const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	(void)ackPayload;
+	if ((NrfSimMicros() - PeerWindowStart) % (LPL_PERIOD_MS * 1000UL) >= LPL_WINDOW_US)
+		return 0;
+
+	if (frame->data[0] < LPL_COMMANDS)
+		CommandsArrived[frame->data[0]] = 1;
+	return 1;
+}
+
+static void PrintLowPowerReport(const char* name, uint8_t sent)
+{
+	LplReport report;
+	LplGetReport(&report);
+
+	uint8_t arrived = 0;
+	for (uint8_t i = 0; i < LPL_COMMANDS; i++)
+		arrived += CommandsArrived[i];
+
+	uint32_t totalUs = report.listenUs + report.powerUpUs + report.sleepUs + report.sendUs;
+	fprintf(stderr, "%s: %u/%u arrived, %u windows, listen %lu us, power up %lu us, sleep %lu us, send %lu us\n",
+			name, arrived, sent, report.windows, (unsigned long)report.listenUs, (unsigned long)report.powerUpUs,
+			(unsigned long)report.sleepUs, (unsigned long)report.sendUs);
+	fprintf(stderr, "%s: %lu uJ, %lu uJ per message, %.0f uA average\n", name, (unsigned long)report.energyUj,
+			(unsigned long)report.energyPerMessageUj, totalUs ? report.energyUj * 1e6 / LPL_SUPPLY_MV / totalUs * 1000 : 0);
+	Expect(arrived == sent, "every LPL command arrives");
+}
+
+// Duty-cycled listener getting commands from a sender repeating them until ACKed, then the other way round
+static void LowPower(void)
+{
+	uint8_t command[MAXIMUM_PAYLOAD_SIZE];
+	uint8_t value;
+	memcpy(command, Payload, MAXIMUM_PAYLOAD_SIZE);
+
+	// Listener - the peer sends, with retransmissions over the whole ARC and again after MAX_RT
+	memset(CommandsArrived, 0, sizeof(CommandsArrived));
+	PeerListen(0);
+	NrfSimSetSink(Peer, 0);
+	NrfSimSetAddress(Peer, TX_ADDR, (const uint8_t*)"TEST1");
+	NrfSimPoke(Peer, SETUP_RETR, ARD_US_4000 | ARC_15);
+	NrfSimPoke(Peer, CONFIG, (1<<EN_CRC) | (1<<PWR_UP));
+	PeerWrite(FLUSH_TX, NULL, 0);
+	value = IRQ_CLEAR_MASK;
+	PeerWrite(W_REGISTER | STATUS, &value, 1);
+
+	RegisterLplCallback(CommandReceived);
+	LplResetReport();
+	Begin();
+	LplStart();
+	for (uint8_t i = 0; i < LPL_COMMANDS; i++)
+	{
+		command[0] = i;
+		PeerWrite(W_TX_PAYLOAD, command, MAXIMUM_PAYLOAD_SIZE);
+		PeerListen(1);
+
+		uint64_t giveUp = NrfSimNanos() + 2ULL * LPL_PERIOD_MS * 1000000;
+		while (!(NrfSimPeek(Peer, STATUS) & (1<<TX_DS)) && NrfSimNanos() < giveUp)
+		{
+			LowPowerLoop(LOOP_US);
+			if (NrfSimPeek(Peer, STATUS) & (1<<MAX_RT))
+			{
+				value = (1<<MAX_RT);
+				PeerWrite(W_REGISTER | STATUS, &value, 1);
+			}
+		}
+
+		PeerListen(0);
+		PeerWrite(FLUSH_TX, NULL, 0);
+		value = IRQ_CLEAR_MASK;
+		PeerWrite(W_REGISTER | STATUS, &value, 1);
+
+		// Commands come at random points of the period
+		LowPowerLoop(37000 + i * 11000);
+	}
+	LplStop();
+	DeliveredBytes = 0;
+	for (uint8_t i = 0; i < LPL_COMMANDS; i++)
+		DeliveredBytes += CommandsArrived[i] * MAXIMUM_PAYLOAD_SIZE;
+	End("LowPower(listen, 16 commands)");
+	PrintLowPowerReport("LPL listener", LPL_COMMANDS);
+
+	// Sender - the peer listens in its own windows
+	memset(CommandsArrived, 0, sizeof(CommandsArrived));
+	NrfSimSetPeer(LowPowerPeer);
+	PeerWindowStart = NrfSimMicros() + 20000;
+	RadioEnterTxMode();
+	Settle();
+
+	LplResetReport();
+	Begin();
+	for (uint8_t i = 0; i < LPL_COMMANDS; i++)
+	{
+		command[0] = i;
+		LplSend(command, MAXIMUM_PAYLOAD_SIZE);
+		while (LplIsSending())
+			LowPowerLoop(LOOP_US);
+
+		LowPowerLoop(37000 + i * 11000);
+	}
+	DeliveredBytes = 0;
+	for (uint8_t i = 0; i < LPL_COMMANDS; i++)
+		DeliveredBytes += CommandsArrived[i] * MAXIMUM_PAYLOAD_SIZE;
+	End("LowPower(send, 16 commands)");
+	PrintLowPowerReport("LPL sender", LPL_COMMANDS);
+
+	NrfSimSetPeer(NULL);
+	NrfSimPoke(Peer, SETUP_RETR, 0x03);
+	NrfSimPoke(Peer, CONFIG, (1<<EN_CRC) | (1<<PWR_UP) | (1<<PRIM_RX));
+	NrfSimSetSink(Peer, 1);
+	PeerListen(1);
+	RegisterRadioCallback(DataReceived);
+}
+
+// Hub's nodes, the first six get a pipe of their own, the last two share pipes 0 and 1
+#define HUB_NODES 8
+#define HUB_FIRST_ID 10
+static uint8_t HubFrames[HUB_NODES];
+static uint8_t HubAcked;
+
+static void HubFrameArrived(uint8_t id, uint8_t* data, uint8_t length)
+{
+	if (id - HUB_FIRST_ID < HUB_NODES && length == 1 && data[0] == id)
+		HubFrames[id - HUB_FIRST_ID]++;
+}
+
+// Leaf's callback, the peer is the hub
+static void HubMessageArrived(uint8_t id, uint8_t* data, uint8_t length)
+{
+	if (length == 1 && data[0] == id)
+		HubAcked++;
+}
+
+// Node sends frame with sequence number (and its id as data), returns the id of the node the ACK payload was for
+static uint8_t InjectHubFrame(uint8_t id, uint8_t sequence)
+{
+	uint8_t address[5];
+	uint8_t frame[HUB_HEADER_SIZE + 1] = { id, sequence, id };
+	NrfSimPayload ack;
+
+	HubNodeAddress(id, address);
+	InjectAddressed(address, frame, sizeof(frame), &ack);
+	RADIO_EVENT();
+
+	return ack.length > 1 ? ack.data[0] : 0;
+}
+
+// Concentrator collecting from eight nodes on six pipes, with messages going back on the ACKs
+static void Hub(void)
+{
+	uint8_t message[1];
+	uint8_t address[5];
+	uint8_t delivered = 0;
+	uint8_t misdirected = 0;
+
+	MEASURE("HubInitialize", HubInitialize());
+	RegisterHubCallback(HubFrameArrived);
+	for (uint8_t i = 0; i < HUB_NODES; i++)
+		HubAddNode(HUB_FIRST_ID + i);
+	RadioEnterRxMode();
+	Settle();
+
+	// Two messages for the nodes sharing pipe 0, one for a node with its own pipe
+	message[0] = HUB_FIRST_ID + 6;
+	MEASURE("HubSend", HubSend(message[0], message, 1));
+	message[0] = HUB_FIRST_ID;
+	HubSend(message[0], message, 1);
+	message[0] = HUB_FIRST_ID + 2;
+	HubSend(message[0], message, 1);
+
+	// Four rounds, node 13 skips a sequence number and node 14 sends one twice (MAX_RT on its side)
+	for (uint8_t round = 0; round < 4; round++)
+	{
+		// Node nobody added shows up on pipe 0 (its PID keeps node 14's repeat from looking like one to the device)
+		if (round == 2)
+		{
+			uint8_t stranger[HUB_HEADER_SIZE + 1] = { 99, 0, 99 };
+			HubNodeAddress(HUB_FIRST_ID, address);
+			InjectAddressed(address, stranger, sizeof(stranger), NULL);
+			RADIO_EVENT();
+		}
+
+		for (uint8_t i = 0; i < HUB_NODES; i++)
+		{
+			uint8_t id = HUB_FIRST_ID + i;
+			uint8_t sequence = round;
+
+			if (id == 13 && round >= 2)
+				sequence = round + 1;
+			if (id == 14 && round >= 2)
+				sequence = round - 1;
+
+			uint8_t addressee;
+			if (round == 0 && i == 0)
+			{
+				Begin();
+				addressee = InjectHubFrame(id, sequence);
+				End("RADIO_EVENT(RX_DR hub)");
+			}
+			else
+				addressee = InjectHubFrame(id, sequence);
+
+			if (addressee == id)
+				delivered++;
+			else if (addressee)
+				misdirected++;
+		}
+	}
+
+	uint8_t frames = 0;
+	for (uint8_t i = 0; i < HubNodeCount(); i++)
+	{
+		const HubNodeStats* node = HubGetNode(i);
+		fprintf(stderr, "Hub node %u pipe %u: %u packets, %u lost, %u duplicates, %u downlinks\n", node->id, node->pipe,
+				node->packets, node->lost, node->duplicates, node->downlinks);
+		frames += HubFrames[i];
+	}
+	fprintf(stderr, "Hub: %u/31 frames delivered, %u unknown, downlink %u/3 delivered, %u went to another node (expected 1)\n",
+			frames, HubUnknownFrames(), delivered, misdirected);
+	Expect(frames == 31 && HubUnknownFrames() == 1, "hub takes every frame from known nodes only");
+	Expect(delivered == 3 && misdirected == 1, "hub downlinks go to their nodes");
+
+	// Leaf side, the peer plays the hub
+	RadioEnterTxMode();
+	Settle();
+	HubJoin(HUB_FIRST_ID, (const uint8_t*)"TEST1");
+	RegisterHubCallback(HubMessageArrived);
+	HubAcked = 0;
+	uint8_t reply[2] = { HUB_FIRST_ID, HUB_FIRST_ID };
+	PeerAckPayload(reply, sizeof(reply));
+	Begin();
+	HubLeafSend(message, 1);
+	WaitSent();
+	End("HubLeafSend");
+	fprintf(stderr, "Hub leaf: %u/1 messages from the hub\n", HubAcked);
+	Expect(HubAcked == 1, "leaf gets the hub's message");
+
+	RadioCommitConfig_P(&RadioDefaultConfig);
+	RegisterRadioCallback(DataReceived);
+}
+
+// Frames sent by the chain scenarios
+#define NET_FRAMES 16
+
+// What the radio has sent to the next hop, and what the previous hop has sent to it
+static NrfSimFrame NetAir[NET_FRAMES];
+static NrfSimFrame NetIncoming[NET_FRAMES];
+static uint8_t NetAirCount;
+
+// Set while the previous hop's frames are injected, they reach the scripted next hop too
+static uint8_t NetInjecting;
+
+// Application callbacks, only the last node on the path should get any
+static uint8_t NetWoken;
+
+static void NetDelivered(uint16_t from, uint8_t* data, uint8_t length)
+{
+	(void)from;
+	(void)data;
+	(void)length;
+	NetWoken++;
+}
+
+// Next hop, acknowledges everything and keeps it for the radio to relay as the next node
+static uint8_t NetHop(const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	(void)ackPayload;
+	if (NetInjecting)
+		return 0;
+
+	if (NetAirCount < NET_FRAMES)
+		NetAir[NetAirCount++] = *frame;
+	return 1;
+}
+
+static void NetLoop(void)
+{
+	Idle(LOOP_US);
+	RADIO_EVENT();
+	NET_EVENT();
+}
+
+// Radio becomes the node, with what the previous one has sent waiting to be injected
+static uint8_t NetBecome(uint16_t node)
+{
+	uint8_t count = NetAirCount;
+
+	memcpy(NetIncoming, NetAir, sizeof(NetAir));
+	NetAirCount = 0;
+	NetInitialize(node);
+	Settle();
+
+	return count;
+}
+
+// Frames from the node at depth hops up to the root (or down from the root), relayed by every node on the way
+// The driver runs a single device, so the radio plays each node in turn and frames go hop by hop:
+// one channel, one transmission at a time. Returns the time the nodes were busy, reconfiguring not counted
+static uint64_t NetChain(uint8_t hops, uint8_t frames, uint8_t down)
+{
+	static uint8_t run = 0;
+	uint16_t path[NET_LEVELS + 1];
+	uint8_t data[NET_DATA_SIZE];
+	uint64_t busy = 0;
+	uint64_t start;
+
+	memcpy(data, Payload, NET_DATA_SIZE);
+
+	// Child 1 of the root, child 2 of that one...
+	path[0] = NET_ROOT;
+	for (uint8_t i = 1; i <= hops; i++)
+		path[i] = NetChildAddress(path[i - 1], (i - 1) % NET_CHILDREN + 1);
+
+	uint16_t source = down ? path[0] : path[hops];
+	uint16_t destination = down ? path[hops] : path[0];
+
+	// Source
+	NetAirCount = 0;
+	NetInitialize(source);
+	Settle();
+	start = NrfSimNanos();
+	for (uint8_t queued = 0; queued < frames || NetPending(); )
+	{
+		// Different every time, or the device would take some for retransmissions of the last run's frames
+		data[0] = run++;
+		if (queued < frames && NetSend(destination, data, NET_DATA_SIZE) == QUEUE_OK)
+			queued++;
+		NetLoop();
+	}
+	busy += NrfSimNanos() - start;
+
+	// Relays and the destination, each gets back to listening before the next frame
+	for (uint8_t i = 1; i <= hops; i++)
+	{
+		uint8_t count = NetBecome(down ? path[i] : path[hops - i]);
+
+		start = NrfSimNanos();
+		for (uint8_t j = 0; j < count; j++)
+		{
+			NetInjecting = 1;
+			InjectAddressed(NetIncoming[j].address, NetIncoming[j].data, NetIncoming[j].length, NULL);
+			NetInjecting = 0;
+			do
+				NetLoop();
+			while (NetPending());
+			NetLoop();
+			Settle();
+		}
+		busy += NrfSimNanos() - start;
+	}
+
+	return busy;
+}
+
+static void NetChainMeasured(const char* name, uint8_t hops, uint8_t frames)
+{
+	NetStats stats;
+
+	NetWoken = 0;
+	Begin();
+	uint64_t busy = NetChain(hops, frames, 0);
+	NetGetStats(&stats);
+	DeliveredBytes = stats.delivered * NET_DATA_SIZE;
+	End(name);
+
+	// One node at a time is busy, time spent reconfiguring the radio for the next one doesn't count
+	if (ResultCount && strcmp(Results[ResultCount - 1].name, name) == 0)
+		Results[ResultCount - 1].elapsedNs = busy;
+
+	fprintf(stderr, "Net %u hops: %u/%u delivered, %.0f us per frame, application called %u times\n", hops,
+			stats.delivered, frames, busy / 1000.0 / frames, NetWoken);
+	Expect(stats.delivered == frames && NetWoken == frames, "network delivers every frame once");
+}
+
+// Tree network relaying over growing number of hops, and a relay's limits
+static void Network(void)
+{
+	char name[40];
+	NetStats stats;
+	uint8_t frame[NET_HEADER_SIZE + 1] = { NET_ROOT, NET_ROOT, 0x11, 0x00, NET_MAX_HOPS, 0 };
+	uint8_t address[5];
+
+	PeerListen(0);
+	NrfSimSetPeer(NetHop);
+	RegisterNetCallback(NetDelivered);
+
+	for (uint8_t hops = 1; hops <= 4; hops++)
+	{
+		snprintf(name, sizeof(name), "Net(1 frame, %u hops)", hops);
+		NetChainMeasured(name, hops, 1);
+		snprintf(name, sizeof(name), "Net(16 x 27 B, %u hops)", hops);
+		NetChainMeasured(name, hops, NET_FRAMES);
+	}
+
+	// Down the tree
+	NetWoken = 0;
+	NetChain(3, 1, 1);
+	fprintf(stderr, "Net down 3 hops: application called %u times (expected 1)\n", NetWoken);
+	Expect(NetWoken == 1, "frame goes down the tree");
+
+	// Relay at 01 takes frames from child 011 on pipe 2
+	uint16_t relay = NetChildAddress(NET_ROOT, 1);
+	address[0] = NET_PIPE_LSB + 1;
+	address[1] = relay & 0xFF;
+	address[2] = relay >> 8;
+	memcpy(&address[3], NET_ADDRESS_BASE, 2);
+
+	// Frame that has made all its hops
+	NetInitialize(relay);
+	Settle();
+	InjectAddressed(address, frame, sizeof(frame), NULL);
+	NetLoop();
+
+	// Six frames at once, two more than the queue takes
+	frame[4] = 0;
+	for (uint8_t i = 0; i < 6; i++)
+	{
+		frame[NET_HEADER_SIZE] = i;
+		InjectAddressed(address, frame, sizeof(frame), NULL);
+		if (i % 3 == 2)
+			RADIO_EVENT();
+	}
+	while (NetPending())
+		NetLoop();
+
+	NetGetStats(&stats);
+	fprintf(stderr, "Net relay: %u forwarded, %u dropped, %u expired (expected 4, 2, 1)\n",
+			stats.forwarded, stats.dropped, stats.expired);
+	Expect(stats.forwarded == 4 && stats.dropped == 2 && stats.expired == 1, "relay keeps to its queue and hop limit");
+
+	NetLoop();
+	Settle();
+	NrfSimSetPeer(NULL);
+	PeerListen(1);
+	RadioCommitConfig_P(&RadioDefaultConfig);
+	RegisterRadioCallback(DataReceived);
+}
+
+// Share of RPD samples that found something on the channels, in %
+static unsigned ScanBusy(const uint8_t* histogram, uint8_t first, uint8_t last, uint8_t sweeps)
+{
+	unsigned total = 0;
+	for (uint8_t i = first; i <= last; i++)
+		total += histogram[i];
+
+	return total * 100 / ((last - first + 1) * sweeps * SCAN_SAMPLES);
+}
+
+// WiFi and a narrow interferer in the band, the radio looks for the quietest channel
+static void Scanner(void)
+{
+	uint8_t histogram[SCAN_CHANNELS];
+	uint8_t channel;
+
+	// WiFi channels 1, 6 and 11 (22 MHz around 2412, 2437 and 2462 MHz), something narrow at 2480 MHz
+	for (uint8_t i = 1; i <= 23; i++)
+		NrfSimSetNoise(i, 300);
+	for (uint8_t i = 26; i <= 48; i++)
+		NrfSimSetNoise(i, 600);
+	for (uint8_t i = 51; i <= 73; i++)
+		NrfSimSetNoise(i, 150);
+	NrfSimSetNoise(80, 500);
+
+	RadioEnterRxMode();
+	Settle();
+	MEASURE("ScanChannels(1 sweep)", ScanChannels(histogram, 1));
+	uint8_t busy[5] = { ScanBusy(histogram, 1, 23, 1), ScanBusy(histogram, 26, 48, 1), ScanBusy(histogram, 51, 73, 1),
+						ScanBusy(histogram, 80, 80, 1), ScanBusy(histogram, 74, 79, 1) };
+	fprintf(stderr, "Scan: WiFi 1 %u%%, WiFi 6 %u%%, WiFi 11 %u%%, 2480 MHz %u%%, 2474-2479 MHz %u%% busy (expected 30, 60, 15, 50, 0)\n",
+			busy[0], busy[1], busy[2], busy[3], busy[4]);
+	Expect(abs(busy[0] - 30) <= 5 && abs(busy[1] - 60) <= 5 && abs(busy[2] - 15) <= 5 && abs(busy[3] - 50) <= 5 && busy[4] == 0,
+		   "scan sees the noise where it is");
+
+	MEASURE("ScanSelectChannel(4 sweeps)", channel = ScanSelectChannel(4));
+	fprintf(stderr, "Scan: picked channel %u (expected 75, first with quiet neighbours)\n", channel);
+	Expect(channel == 75, "scan picks the quietest channel");
+
+	for (uint8_t i = 0; i < SCAN_CHANNELS; i++)
+		NrfSimSetNoise(i, 0);
+	RadioSetChannel(50);
+}
+
+#define HOP_MESSAGES 64
+#define HOP_TABLE_LENGTH sizeof(HopDefaultTable)
+
+// Time between the scripted leader's messages
+#define HOP_MESSAGE_GAP_US 2000
+
+static uint8_t HopArrived[HOP_MESSAGES];
+
+// Scripted follower, slot and its start taken from the last beacon, acknowledges anything before the first one
+static uint8_t FollowerSynced;
+static uint8_t FollowerSlot;
+static uint32_t FollowerSlotStart;
+
+// Scripted leader, on its own clock
+static uint8_t LeaderSlot;
+static uint32_t LeaderSlotStart;
+static uint8_t LeaderBeacon;
+static uint32_t LeaderNextUs;
+static uint8_t LeaderNext;
+
+static uint8_t HopArrivedCount(void)
+{
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < HOP_MESSAGES; i++)
+		count += HopArrived[i];
+
+	return count;
+}
+
+static void HopReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	(void)length;
+	(void)pipe;
+	if (data[0] < HOP_MESSAGES)
+		HopArrived[data[0]] = 1;
+}
+
+// Follower on the other end of the air, hears only the channel of its slot once it has found the leader
+static uint8_t HopFollowerPeer(const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	(void)ackPayload;
+	if (FollowerSynced)
+	{
+		uint32_t slots = (NrfSimMicros() - FollowerSlotStart) / HOP_PERIOD_US;
+		if (frame->channel != pgm_read_byte(&HopDefaultTable[(FollowerSlot + slots) % HOP_TABLE_LENGTH]))
+			return 0;
+	}
+
+	if (frame->length == HOP_BEACON_SIZE && frame->data[0] == HOP_BEACON)
+	{
+		FollowerSynced = 1;
+		FollowerSlot = frame->data[1];
+		FollowerSlotStart = NrfSimMicros() - HOP_SETTLE_US;
+		return 0;
+	}
+
+	if (frame->data[0] < HOP_MESSAGES)
+		HopArrived[frame->data[0]] = 1;
+	return 1;
+}
+
+// Leader on the other end of the air: a beacon after every hop, then the next message every HOP_MESSAGE_GAP_US
+// until HOP_GUARD_US before the next hop, sent again until it's acknowledged. Silent - out of range
+static void HopLeaderStep(uint8_t silent)
+{
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+	uint32_t now = NrfSimMicros();
+
+	if (now - LeaderSlotStart >= HOP_PERIOD_US)
+	{
+		LeaderSlotStart += HOP_PERIOD_US;
+		LeaderSlot = (LeaderSlot + 1) % HOP_TABLE_LENGTH;
+		LeaderBeacon = 1;
+	}
+
+	uint32_t inSlot = now - LeaderSlotStart;
+	uint8_t channel = pgm_read_byte(&HopDefaultTable[LeaderSlot]);
+
+	if (silent || inSlot < HOP_SETTLE_US)
+		return;
+
+	if (LeaderBeacon)
+	{
+		data[0] = HOP_BEACON;
+		data[1] = LeaderSlot;
+		InjectOn(channel, Radio->rxAddressP0, data, HOP_BEACON_SIZE, NULL);
+		LeaderBeacon = 0;
+		LeaderNextUs = now + HOP_MESSAGE_GAP_US / 4;
+		return;
+	}
+
+	if (LeaderNext == HOP_MESSAGES || inSlot > HOP_PERIOD_US - HOP_GUARD_US || (int32_t)(now - LeaderNextUs) < 0)
+		return;
+
+	memcpy(data, Payload, MAXIMUM_PAYLOAD_SIZE);
+	data[0] = LeaderNext;
+	if (InjectOn(channel, Radio->rxAddressP0, data, MAXIMUM_PAYLOAD_SIZE, NULL))
+		LeaderNext++;
+	LeaderNextUs = now + HOP_MESSAGE_GAP_US;
+}
+
+// Main loop of the follower, the scripted leader goes on while the loop is away
+static void HopFollowerLoop(uint32_t us, uint8_t away, uint8_t silent)
+{
+	uint64_t end = NrfSimNanos() + (uint64_t)us * 1000;
+	while (NrfSimNanos() < end)
+	{
+		Idle(LOOP_US);
+		HopLeaderStep(silent);
+		if (away)
+			continue;
+		RADIO_EVENT();
+		HOP_EVENT();
+	}
+}
+
+static void HopLoop(void)
+{
+	Idle(LOOP_US);
+	RADIO_EVENT();
+	HOP_EVENT();
+}
+
+// Waits for the end of the transmission, returns RadioSendResult()
+static uint8_t HopWaitResult(void)
+{
+	uint8_t result;
+
+	while ((result = RadioSendResult()) == SEND_PENDING)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+
+	return result;
+}
+
+// WiFi on channel 6 (2426..2448 MHz) takes 90% of the frames, one channel inside it against hopping over the band
+static void Hopping(void)
+{
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+	uint8_t failed = 0;
+	HopStats stats;
+
+	for (uint8_t i = 26; i <= 48; i++)
+		NrfSimSetNoise(i, 900);
+
+	memcpy(data, Payload, MAXIMUM_PAYLOAD_SIZE);
+	NrfSimSetPeer(HopFollowerPeer);
+	PeerListen(0);
+	RadioEnterTxMode();
+	Settle();
+
+	// Stuck on channel 40, with the same retransmissions and the same number of tries as a hopping message
+	memset(HopArrived, 0, sizeof(HopArrived));
+	FollowerSynced = 0;
+	RadioConfigRetransmission(ARD_US_500, ARC_3);
+	RadioSetChannel(40);
+	Begin();
+	for (uint8_t i = 0; i < HOP_MESSAGES; i++)
+	{
+		uint8_t tries = 0;
+
+		data[0] = i;
+		do
+			RadioSendBuffer(data, MAXIMUM_PAYLOAD_SIZE);
+		while (HopWaitResult() != SEND_DONE && ++tries < HOP_RETRIES);
+
+		if (tries == HOP_RETRIES)
+			failed++;
+	}
+	DeliveredBytes = HopArrivedCount() * MAXIMUM_PAYLOAD_SIZE;
+	End("Hop(channel 40, 64 x 32 B)");
+	fprintf(stderr, "Hop channel 40: %u/%u delivered, %u failed\n", HopArrivedCount(), HOP_MESSAGES, failed);
+
+	// Hopping leader
+	memset(HopArrived, 0, sizeof(HopArrived));
+	Begin();
+	HopStart(HOP_LEADER, HopDefaultTable, HOP_TABLE_LENGTH);
+	uint8_t lookAlike[HOP_BEACON_SIZE] = { HOP_BEACON, 1 };
+	uint8_t refused = HopSend(lookAlike, HOP_BEACON_SIZE) == HOP_REFUSED && HopPending() == 0;
+	fprintf(stderr, "Hop leader: beacon look-alike %s (expected refused)\n", refused ? "refused" : "queued");
+	Expect(refused, "HopSend() refuses a beacon look-alike");
+	refused = HopSend(data, 0) == HOP_REFUSED && HopPending() == 0;
+	fprintf(stderr, "Hop leader: empty message %s (expected refused)\n", refused ? "refused" : "queued");
+	Expect(refused, "HopSend() refuses an empty message");
+	for (uint8_t queued = 0; queued < HOP_MESSAGES || HopPending(); )
+	{
+		data[0] = queued;
+		if (queued < HOP_MESSAGES && HopSend(data, MAXIMUM_PAYLOAD_SIZE) == QUEUE_OK)
+			queued++;
+		HopLoop();
+	}
+	DeliveredBytes = HopArrivedCount() * MAXIMUM_PAYLOAD_SIZE;
+	End("Hop(leader, 64 x 32 B)");
+	HopGetStats(&stats);
+	fprintf(stderr, "Hop leader: %u/%u delivered, %u sent, %u retried, %u failed, %u slots\n", HopArrivedCount(),
+			HOP_MESSAGES, stats.sent, stats.retried, stats.failed, stats.slots);
+	Expect(HopArrivedCount() == HOP_MESSAGES && stats.failed == 0, "hopping gets every message past the noise");
+	HopStop();
+	NrfSimSetPeer(NULL);
+
+	// Follower, its clock 3 ms behind the leader's
+	memset(HopArrived, 0, sizeof(HopArrived));
+	RegisterHopCallback(HopReceived);
+	RadioEnterRxMode();
+	Settle();
+	HopStart(HOP_FOLLOWER, HopDefaultTable, HOP_TABLE_LENGTH);
+	LeaderSlot = 0;
+	LeaderSlotStart = NrfSimMicros() - 3000;
+	LeaderBeacon = 1;
+	LeaderNext = 0;
+	Begin();
+	while (LeaderNext < HOP_MESSAGES / 2)
+		HopFollowerLoop(LOOP_US, 0, 0);
+	DeliveredBytes = HopArrivedCount() * MAXIMUM_PAYLOAD_SIZE;
+	End("Hop(follower, 32 x 32 B)");
+
+	// Main loop away for 2.5 slots, both ends skip the same slots
+	HopFollowerLoop(HOP_PERIOD_US * 5 / 2, 1, 0);
+	uint8_t before = LeaderNext;
+	HopFollowerLoop(HOP_PERIOD_US * 2, 0, 0);
+	HopGetStats(&stats);
+	fprintf(stderr, "Hop follower: %u/%u arrived, %u after the main loop has been away, %u resyncs (expected 0)\n",
+			HopArrivedCount(), LeaderNext, LeaderNext - before, stats.resyncs);
+	Expect(HopArrivedCount() == LeaderNext && stats.resyncs == 0, "follower keeps up after the main loop has been away");
+
+	// Leader out of range for 6 slots, the follower stops on the first channel and waits for it
+	HopFollowerLoop(HOP_PERIOD_US * 6, 0, 1);
+	uint32_t back = NrfSimMicros();
+	while (stats.resyncs == 0 && NrfSimMicros() - back < 2 * HOP_TABLE_LENGTH * HOP_PERIOD_US)
+	{
+		HopFollowerLoop(LOOP_US, 0, 0);
+		HopGetStats(&stats);
+	}
+	while (LeaderNext < HOP_MESSAGES)
+		HopFollowerLoop(LOOP_US, 0, 0);
+	HopGetStats(&stats);
+	fprintf(stderr, "Hop follower: %u resyncs (expected 1) %lu ms after the leader is back, %u/%u arrived, %u slots missed\n",
+			stats.resyncs, (unsigned long)(NrfSimMicros() - back) / 1000, HopArrivedCount(), HOP_MESSAGES, stats.missed);
+	Expect(stats.resyncs == 1 && HopArrivedCount() == HOP_MESSAGES, "follower finds the leader again");
+	HopStop();
+
+	for (uint8_t i = 0; i < SCAN_CHANNELS; i++)
+		NrfSimSetNoise(i, 0);
+	PeerListen(1);
+	RadioCommitConfig_P(&RadioDefaultConfig);
+	RegisterRadioCallback(DataReceived);
+}
+
+#define ADAPT_PACKETS 256
+
+// Scripted receiver on one data rate, takes notices and comes down after silence like AdaptReceived() does
+static uint8_t ReceiverSpeed;
+static uint32_t ReceiverHeard;
+static uint16_t ReceiverLast;
+static uint16_t ReceiverDelivered;
+
+static uint8_t AdaptReceiver(const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	(void)ackPayload;
+
+	// One rate down for every ADAPT_SILENCE_MS without a payload
+	while (NrfSimMicros() - ReceiverHeard >= ADAPT_SILENCE_MS * 1000UL && ReceiverSpeed != KBPS_250)
+	{
+		ReceiverHeard += ADAPT_SILENCE_MS * 1000UL;
+		ReceiverSpeed = ReceiverSpeed == MBPS_2 ? MBPS_1 : KBPS_250;
+	}
+
+	if (frame->rate != ReceiverSpeed)
+		return 0;
+	ReceiverHeard = NrfSimMicros();
+
+	// ACK leaves on the old rate
+	if (frame->length == ADAPT_NOTICE_SIZE && frame->data[0] == ADAPT_NOTICE)
+	{
+		ReceiverSpeed = frame->data[1];
+		return 1;
+	}
+
+	// Retransmission after a lost ACK
+	if (frame->data[0] != ReceiverLast)
+	{
+		ReceiverLast = frame->data[0];
+		ReceiverDelivered++;
+	}
+	return 1;
+}
+
+static void AdaptLoop(void)
+{
+	Idle(LOOP_US);
+	RADIO_EVENT();
+	ADAPT_EVENT();
+}
+
+static const char* SpeedName(uint8_t speed)
+{
+	return speed == KBPS_250 ? "250 kbps" : speed == MBPS_1 ? "1 Mbps" : "2 Mbps";
+}
+
+static int PowerDbm(uint8_t power)
+{
+	return (power >> RF_PWR_LOW) * 6 - 18;
+}
+
+// 256 packets with adaptation, the link carries on from the last distance
+// fixed - packets the fixed link delivered at the distance
+static void AdaptDistance(uint8_t pathLoss, uint8_t back, uint16_t fixed)
+{
+	char name[40];
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+	AdaptStats before, after;
+
+	memcpy(data, Payload, MAXIMUM_PAYLOAD_SIZE);
+	NrfSimSetPathLoss(pathLoss);
+	AdaptGetStats(0, &before);
+	ReceiverLast = 0xFFFF;
+	ReceiverDelivered = 0;
+
+	Begin();
+	for (uint16_t i = 0; i < ADAPT_PACKETS; i++)
+	{
+		data[0] = i;
+		AdaptSend(data, MAXIMUM_PAYLOAD_SIZE);
+		do
+			AdaptLoop();
+		while (AdaptSendResult() == SEND_PENDING);
+	}
+	DeliveredBytes = ReceiverDelivered * MAXIMUM_PAYLOAD_SIZE;
+	snprintf(name, sizeof(name), "Adapt(%s %u dB, 256 x 32 B)", back ? "back to" : "path loss", pathLoss);
+	End(name);
+
+	AdaptGetStats(0, &after);
+	fprintf(stderr, "Adapt %u dB: %u/%u delivered, %u failed, %.2f retransmissions per packet, %u rate and %u power changes, "
+			"ends at %s %d dBm\n", pathLoss, ReceiverDelivered, ADAPT_PACKETS, after.failed - before.failed,
+			(double)(after.retransmissions - before.retransmissions) / ADAPT_PACKETS, after.rateChanges - before.rateChanges,
+			after.powerChanges - before.powerChanges, SpeedName(after.speed), PowerDbm(after.power));
+	Expect(ReceiverDelivered * 100UL >= fixed * 95UL && ReceiverDelivered >= ADAPT_PACKETS / 2,
+		   "adaptation keeps up with the fixed link and gets at least half through");
+}
+
+// Same packets at 2 Mbps and 0 dBm, retransmissions as AdaptInitialize() starts with
+// Returns the number of packets delivered
+static uint16_t FixedDistance(uint8_t pathLoss)
+{
+	char name[40];
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+	uint16_t failed = 0;
+
+	memcpy(data, Payload, MAXIMUM_PAYLOAD_SIZE);
+	NrfSimSetPathLoss(pathLoss);
+	ReceiverSpeed = MBPS_2;
+	ReceiverHeard = NrfSimMicros();
+	ReceiverLast = 0xFFFF;
+	ReceiverDelivered = 0;
+
+	Begin();
+	for (uint16_t i = 0; i < ADAPT_PACKETS; i++)
+	{
+		data[0] = i;
+		RadioSendBuffer(data, MAXIMUM_PAYLOAD_SIZE);
+		if (HopWaitResult() == SEND_FAILED)
+			failed++;
+	}
+	DeliveredBytes = ReceiverDelivered * MAXIMUM_PAYLOAD_SIZE;
+	snprintf(name, sizeof(name), "Fixed(2 Mbps 0 dBm, path loss %u dB)", pathLoss);
+	End(name);
+
+	fprintf(stderr, "Fixed %u dB: %u/%u delivered, %u failed\n", pathLoss, ReceiverDelivered, ADAPT_PACKETS, failed);
+	return ReceiverDelivered;
+}
+
+static void AdaptDataReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	(void)pipe;
+	if (!AdaptReceived(data, length))
+		ReceivedCount++;
+}
+
+// Node walking away from its receiver and back, then the receiving end of the notices
+static void Adaptation(void)
+{
+	static const uint8_t distances[] = { 60, 75, 82, 90, 60 };
+	uint8_t notice[ADAPT_NOTICE_SIZE] = { ADAPT_NOTICE, MBPS_1 };
+	uint8_t speeds[3];
+	uint16_t fixed[sizeof(distances)];
+
+	NrfSimSetPeer(AdaptReceiver);
+	PeerListen(0);
+	RadioEnterTxMode();
+	Settle();
+
+	// Everything fixed, sent the way the link allows
+	RadioSetSpeed(MBPS_2);
+	RadioSetPower(POWER_DBM_0);
+	RadioConfigRetransmission(ARD_US_250, ADAPT_ARC);
+	for (uint8_t i = 0; i < sizeof(distances) - 1; i++)
+		fixed[i] = FixedDistance(distances[i]);
+	fixed[sizeof(distances) - 1] = fixed[0];
+
+	ReceiverSpeed = MBPS_2;
+	ReceiverHeard = NrfSimMicros();
+	AdaptInitialize();
+	uint8_t lookAlike[ADAPT_NOTICE_SIZE] = { ADAPT_NOTICE, MBPS_1 };
+	uint8_t refused = AdaptSend(lookAlike, ADAPT_NOTICE_SIZE) == ADAPT_RESERVED && AdaptSendResult() != SEND_PENDING;
+	fprintf(stderr, "Adapt sender: notice look-alike %s (expected refused)\n", refused ? "refused" : "sent");
+	Expect(refused, "AdaptSend() refuses a notice look-alike");
+	for (uint8_t i = 0; i < sizeof(distances); i++)
+		AdaptDistance(distances[i], i == sizeof(distances) - 1, fixed[i]);
+
+	NrfSimSetPathLoss(0);
+	NrfSimSetPeer(NULL);
+
+	// Receiver: notice of 1 Mbps, a packet on it, silence, notice of 2 Mbps
+	RegisterRadioCallback(AdaptDataReceived);
+	RadioSetSpeed(MBPS_2);
+	RadioEnterRxMode();
+	Settle();
+	ReceivedCount = 0;
+
+	InjectData(notice, ADAPT_NOTICE_SIZE, NULL);
+	AdaptLoop();
+	speeds[0] = NrfSimPeek(Radio, RF_SETUP) & ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH));
+	InjectPayload(NULL);
+	for (uint32_t waited = 0; waited < ADAPT_SILENCE_MS * 1000UL + 1000; waited += LOOP_US)
+		AdaptLoop();
+	speeds[1] = NrfSimPeek(Radio, RF_SETUP) & ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH));
+	notice[1] = MBPS_2;
+	InjectData(notice, ADAPT_NOTICE_SIZE, NULL);
+	AdaptLoop();
+	speeds[2] = NrfSimPeek(Radio, RF_SETUP) & ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH));
+	fprintf(stderr, "Adapt receiver: %s, %s after %u ms of silence, %s, %lu payloads for the application "
+			"(expected 1 Mbps, 250 kbps, 2 Mbps, 1)\n", SpeedName(speeds[0]), SpeedName(speeds[1]), ADAPT_SILENCE_MS,
+			SpeedName(speeds[2]), (unsigned long)ReceivedCount);
+	Expect(speeds[0] == MBPS_1 && speeds[1] == KBPS_250 && speeds[2] == MBPS_2 && ReceivedCount == 1,
+		   "receiver follows notices and comes down after silence");
+
+	PeerListen(1);
+	RadioCommitConfig_P(&RadioDefaultConfig);
+	RegisterRadioCallback(DataReceived);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Brown-out
+//////////////////////////////////////////////////////////////////////////
+
+// Device reset behind the driver's back is found and undone, in RX mode and during a transmission
+static void BrownOut(void)
+{
+	RegisterRadioCallback(DataReceived);
+	RadioEnterRxMode();
+	Settle();
+	uint8_t before = RadioVerifyRegisters();
+
+	NrfSimBrownOut(Radio);
+	uint8_t found = RadioVerifyRegisters();
+	uint64_t startNs = NrfSimNanos();
+	RadioRestoreRegisters();
+	Settle();
+	uint32_t settledUs = (uint32_t)((NrfSimNanos() - startNs) / 1000);
+	uint8_t after = RadioVerifyRegisters();
+
+	uint32_t received = ReceivedCount;
+	InjectPayload(NULL);
+	RADIO_EVENT();
+	uint8_t listening = State == RX_MODE && ReceivedCount == received + 1;
+
+	fprintf(stderr, "Brown-out in RX mode: %u registers clean, %u differ, %u after restore, settled in %lu us, %s "
+			"(expected 0, >0, 0, >= 1500, listening)\n", before, found, after, (unsigned long)settledUs,
+			listening ? "listening" : "deaf");
+	Expect(before == 0 && found > 0 && after == 0, "RadioRestoreRegisters() undoes a device reset");
+	Expect(settledUs >= 1500 && listening, "device powers up again and goes back to RX mode");
+
+	// Transmission cut short, the result mustn't stay pending
+	RadioEnterTxMode();
+	PeerListen(0);
+	RadioSendBuffer(Payload, MAXIMUM_PAYLOAD_SIZE);
+	NrfSimBrownOut(Radio);
+	RadioRestoreRegisters();
+	Settle();
+	uint8_t result = RadioSendResult();
+	PeerListen(1);
+	uint32_t delivered = Peer->stats.rxPackets;
+	uint8_t started = RadioSendBuffer(Payload, MAXIMUM_PAYLOAD_SIZE);
+	for (uint32_t waited = 0; State != STANDBY_1 && waited < 100000; waited += LOOP_US)
+	{
+		Idle(LOOP_US);
+		RADIO_EVENT();
+	}
+	fprintf(stderr, "Brown-out during a transmission: %s, next send %s (expected failed, delivered)\n",
+			result == SEND_FAILED ? "failed" : "pending", started && Peer->stats.rxPackets == delivered + 1 ? "delivered" : "lost");
+	Expect(result == SEND_FAILED && RadioVerifyRegisters() == 0, "transmission cut by a device reset ends as failed");
+	Expect(started && Peer->stats.rxPackets == delivered + 1, "device sends again after the restore");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// SPI block transfers
+//////////////////////////////////////////////////////////////////////////
+
+// Reads TX_ADDR back with SpiRead() and the given filler
+static void BusReadAddress(uint8_t* address, uint8_t filler)
+{
+	CSN_LOW;
+	SpiShift(R_REGISTER | TX_ADDR);
+	SpiRead(address, 5, filler);
+	CSN_HIGH;
+}
+
+// Every block transfer has to move the bytes it's given, zeros and 0xFF included
+static void Bus(void)
+{
+	static const uint8_t flashAddress[5] PROGMEM = { 0x00, 0xFF, 0x80, 0x01, 0x00 };
+	static const uint8_t address[5] = { 0xE7, 0x00, 0xFF, 0x7E, 0x01 };
+	uint8_t saved[5], read[5];
+	uint8_t tx[6] = { R_REGISTER | TX_ADDR, NOP, NOP, NOP, NOP, NOP };
+	uint8_t rx[6];
+	uint8_t expected[5];
+
+	BusReadAddress(saved, NOP);
+
+	// SpiWrite(), read back with both constant fillers and another one
+	CSN_LOW;
+	SpiShift(W_REGISTER | TX_ADDR);
+	SpiWrite(address, 5);
+	CSN_HIGH;
+	BusReadAddress(read, NOP);
+	uint8_t written = memcmp(read, address, 5) == 0;
+	BusReadAddress(read, 0x00);
+	written = written && memcmp(read, address, 5) == 0;
+	BusReadAddress(read, 0x5A);
+	written = written && memcmp(read, address, 5) == 0;
+
+	// SpiTransfer() gets STATUS with the command and the register after it
+	CSN_LOW;
+	SpiTransfer(tx, rx, sizeof(tx));
+	CSN_HIGH;
+	uint8_t transferred = rx[0] == NrfSimPeek(Radio, STATUS) && memcmp(&rx[1], address, 5) == 0;
+
+	// SpiWrite_P()
+	CSN_LOW;
+	SpiShift(W_REGISTER | TX_ADDR);
+	SpiWrite_P(flashAddress, 5);
+	CSN_HIGH;
+	memcpy_P(expected, flashAddress, 5);
+	BusReadAddress(read, NOP);
+	written = written && memcmp(read, expected, 5) == 0;
+
+	// Binary payload straight into the TX FIFO
+	uint8_t queued = Radio->txCount;
+	CSN_LOW;
+	SpiShift(W_TX_PAYLOAD);
+	SpiWrite_P(FlashPayload, MAXIMUM_PAYLOAD_SIZE);
+	CSN_HIGH;
+	uint8_t payload[MAXIMUM_PAYLOAD_SIZE];
+	memcpy_P(payload, FlashPayload, MAXIMUM_PAYLOAD_SIZE);
+	uint8_t loaded = Radio->txCount == queued + 1 && Radio->txFifo[queued].length == MAXIMUM_PAYLOAD_SIZE &&
+					 memcmp(Radio->txFifo[queued].data, payload, MAXIMUM_PAYLOAD_SIZE) == 0;
+
+	CSN_LOW;
+	SpiShift(FLUSH_TX);
+	CSN_HIGH;
+	CSN_LOW;
+	SpiShift(W_REGISTER | TX_ADDR);
+	SpiWrite(saved, 5);
+	CSN_HIGH;
+
+	fprintf(stderr, "SPI blocks: SpiWrite/SpiRead %s, SpiTransfer %s, SpiWrite_P payload %s\n",
+			written ? "intact" : "corrupted", transferred ? "intact" : "corrupted", loaded ? "intact" : "corrupted");
+	Expect(written, "SpiWrite(), SpiWrite_P() and SpiRead() move the right bytes");
+	Expect(transferred, "SpiTransfer() moves the right bytes");
+	Expect(loaded, "SpiWrite_P() loads a binary payload intact");
+}
+
+#if SPI_ASYNC != 0
+// Commands of the jobs in the order their callbacks ran
+static uint8_t JobOrder[3];
+static uint8_t JobsDone;
+
+static void JobComplete(SpiJob* job)
+{
+	if (JobsDone < sizeof(JobOrder))
+		JobOrder[JobsDone++] = job->command;
+}
+
+static void JobPrepare(SpiJob* job, uint8_t command, const uint8_t* tx, uint8_t* rx, uint8_t length)
+{
+	job->command = command;
+	job->tx = tx;
+	job->rx = rx;
+	job->length = length;
+	job->complete = JobComplete;
+}
+
+// Queued jobs run in order, each with chip selected once, and move the right bytes
+// The simulator shifts a job as soon as the bus is free, so this doesn't cover the interrupt's timing
+static void AsyncJobs(void)
+{
+	static const uint8_t address[5] = { 0x00, 0xC3, 0xFF, 0x10, 0x00 };
+	const uint8_t expected[3] = { W_REGISTER | TX_ADDR, R_REGISTER | TX_ADDR, R_RX_PAYLOAD };
+	uint8_t saved[5], read[5];
+	uint8_t payload[MAXIMUM_PAYLOAD_SIZE], sent[MAXIMUM_PAYLOAD_SIZE];
+	SpiJob write, readBack, download;
+
+	memcpy_P(sent, FlashPayload, MAXIMUM_PAYLOAD_SIZE);
+
+	BusReadAddress(saved, NOP);
+
+	// Payload at RX FIFO head for RadioReadPayloadAsync()
+	RadioClearRX();
+	Radio->rxFifo[0].length = MAXIMUM_PAYLOAD_SIZE;
+	Radio->rxFifo[0].pipe = DATA_PIPE_1;
+	memcpy(Radio->rxFifo[0].data, sent, MAXIMUM_PAYLOAD_SIZE);
+	Radio->rxCount = 1;
+
+	JobsDone = 0;
+	uint32_t frames = Radio->stats.csnFrames;
+	JobPrepare(&write, W_REGISTER | TX_ADDR, address, NULL, 5);
+	JobPrepare(&readBack, R_REGISTER | TX_ADDR, NULL, read, 5);
+	SpiSubmit(&write);
+	SpiSubmit(&readBack);
+	RadioReadPayloadAsync(&download, payload, MAXIMUM_PAYLOAD_SIZE, JobComplete);
+	SpiWaitIdle();
+	frames = Radio->stats.csnFrames - frames;
+
+	uint8_t ordered = JobsDone == 3 && memcmp(JobOrder, expected, 3) == 0 && frames == 3 && !SpiIsBusy();
+	uint8_t moved = memcmp(read, address, 5) == 0 && RX_PIPE(download.status) == DATA_PIPE_1 &&
+					memcmp(payload, sent, MAXIMUM_PAYLOAD_SIZE) == 0 && Radio->rxCount == 0;
+
+	CSN_LOW;
+	SpiShift(W_REGISTER | TX_ADDR);
+	SpiWrite(saved, 5);
+	CSN_HIGH;
+
+	fprintf(stderr, "SPI jobs: %u done in %lu CSN frames, %s, data %s (expected 3 in 3, in order, intact)\n", JobsDone,
+			(unsigned long)frames, ordered ? "in order" : "out of order", moved ? "intact" : "corrupted");
+	Expect(ordered, "SPI jobs run in submission order, one CSN frame each");
+	Expect(moved, "SPI jobs and RadioReadPayloadAsync() move the right bytes");
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Report
+//////////////////////////////////////////////////////////////////////////
+static void Print(void)
+{
+	printf("name,csn_frames,spi_bytes,bus_us,elapsed_us,air_us,cycles_per_byte,kbps\n");
+	for (uint8_t i = 0; i < ResultCount; i++)
+	{
+		Result* result = &Results[i];
+
+		// MCU cycles per SPI byte, meaningful for calls that don't wait for the device
+		// Beyond the bus time it's the SPI_XX_OVERHEAD_NS estimates from spi.h, not a measurement
+		double cycles = result->spiBytes ? result->elapsedNs * (F_CPU / 1e9) / result->spiBytes : 0;
+
+		// Payload throughput, only for the scenarios that count delivered bytes
+		double kbps = result->elapsedNs ? result->payloadBytes * 8e6 / result->elapsedNs : 0;
+
+		printf("%s,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f\n", result->name, result->csnFrames, result->spiBytes,
+			   result->busNs / 1000.0, result->elapsedNs / 1000.0, result->airNs / 1000.0, cycles, kbps);
+	}
+}
+
+// Returns the number of rows over budget
+static int Check(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "Cannot open %s\n", path);
+		return 1;
+	}
+
+	int failures = 0;
+	char line[128];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		unsigned frames, bytes;
+		char end;
+
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == '#' || line[0] == 0)
+			continue;
+
+		// Names can hold commas, the budget is in the last two fields
+		// A row that doesn't parse is a failure, not a row that's skipped
+		char* bytesField = strrchr(line, ',');
+		char* framesField = NULL;
+		if (bytesField)
+		{
+			*bytesField = 0;
+			framesField = strrchr(line, ',');
+		}
+		if (!framesField || framesField == line || sscanf(framesField + 1, "%u%c", &frames, &end) != 1 ||
+			sscanf(bytesField + 1, "%u%c", &bytes, &end) != 1)
+		{
+			if (bytesField)
+				*bytesField = ',';
+			fprintf(stderr, "Bad budget row: %s\n", line);
+			failures++;
+			continue;
+		}
+		*framesField = 0;
+
+		const char* name = line;
+		uint8_t found = 0;
+
+		for (uint8_t i = 0; i < ResultCount; i++)
+		{
+			Result* result = &Results[i];
+			if (strcmp(result->name, name) != 0)
+				continue;
+
+			found = 1;
+			if (result->csnFrames > frames || result->spiBytes > bytes)
+			{
+				fprintf(stderr, "Over budget: %s frames %u/%u bytes %u/%u\n",
+						name, result->csnFrames, frames, result->spiBytes, bytes);
+				failures++;
+			}
+		}
+
+		// Renamed or removed call, the budget would never be checked again
+		if (!found)
+		{
+			fprintf(stderr, "Bad budget row: %s has no result\n", name);
+			failures++;
+		}
+	}
+
+	fclose(file);
+	return failures;
+}
+
+int main(int argc, char** argv)
+{
+	Setup();
+	Configuration();
+	Settling();
+	Transmitter();
+	Throughput();
+	Receiver();
+	AckPayloads();
+	Fragments();
+	Link();
+	LowPower();
+	Hub();
+	Network();
+	Scanner();
+	Hopping();
+	Adaptation();
+	BrownOut();
+	Bus();
+#if SPI_ASYNC != 0
+	AsyncJobs();
+#endif
+	Print();
+
+	if (Failures)
+		fprintf(stderr, "%u behaviour checks failed\n", Failures);
+
+	// Budget is checked even when a behaviour check has already failed, so both show up in one run
+	int overBudget = argc > 1 ? Check(argv[1]) : 0;
+
+	return Failures || overBudget ? 1 : 0;
+}
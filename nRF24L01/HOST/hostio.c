@@ -0,0 +1,14 @@
+#include "../Common/Common.h"
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "../NRF/SIM/nrfsim.h"
+
+// Register file behind the <avr/io.h> stand-in
+volatile uint8_t HostIo[0x100];
+
+// Busy delays move the simulated clock forward
+void HostDelayUs(double us)
+{
+	NrfSimAdvance((uint64_t)(us * 1000.0));
+}
@@ -0,0 +1,12 @@
+// Host-side stand-in for <util/atomic.h>
+// The simulator never preempts the caller, so an atomic block is just a block.
+
+#ifndef HOST_UTIL_ATOMIC_H_
+#define HOST_UTIL_ATOMIC_H_
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#define ATOMIC_BLOCK(type) for(uint8_t _atomicOnce = 1; _atomicOnce; _atomicOnce = 0)
+
+#endif /* HOST_UTIL_ATOMIC_H_ */
@@ -0,0 +1,12 @@
+// Host-side stand-in for <util/delay.h>
+// Delays don't burn host time, they advance the simulated device clock instead.
+
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+void HostDelayUs(double us);
+
+#define _delay_us(us) HostDelayUs(us)
+#define _delay_ms(ms) HostDelayUs((ms) * 1000.0)
+
+#endif /* HOST_UTIL_DELAY_H_ */
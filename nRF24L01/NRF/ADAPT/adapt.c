@@ -0,0 +1,344 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "adapt.h"
+
+// Silence has to fit in half of RADIO_TICKS() range
+#if (ADAPT_SILENCE_MS * 1000000ULL / RADIO_TICK_NS > 32767)
+#error "ADAPT_SILENCE_MS is too long for RADIO_TICKS(), use a bigger prescaler!"
+#endif
+
+#define SPEED_LEVELS 3
+#define POWER_LEVELS 4
+
+#define RATE_BITS ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH))
+
+// What's on its way
+#define ADAPT_IDLE		0
+#define ADAPT_NOTICE_ON	1
+#define ADAPT_DATA_ON	2
+
+// Slowest and weakest first
+static const uint8_t Speeds[SPEED_LEVELS] = { KBPS_250, MBPS_1, MBPS_2 };
+static const uint8_t Powers[POWER_LEVELS] = { POWER_DBM_MINUS_18, POWER_DBM_MINUS_12, POWER_DMB_MINUS_6, POWER_DBM_0 };
+
+typedef struct
+{
+	uint8_t speed;				// Level both ends are on
+	uint8_t nextSpeed;			// Level to announce, differs from speed until the peer has taken it
+	uint8_t power;
+	uint8_t packets;			// In this window
+	uint16_t retransmissions;
+	uint8_t good;				// Good windows in a row
+	uint8_t hold;				// Good windows the next step waits for
+	uint8_t probing;			// Last step was to a faster rate or less power
+	AdaptStats stats;
+} AdaptPeer;
+
+static AdaptPeer Peers[ADAPT_PEERS];
+static uint8_t Current = 0;
+
+// Packet AdaptSend() is sending, and how it went
+static uint8_t SendBuffer[MAXIMUM_PAYLOAD_SIZE];
+static uint8_t SendLength;
+static uint8_t Sending = ADAPT_IDLE;
+static uint8_t Result = SEND_DONE;
+
+// Receiver - AdaptReceived() is in use, and when the last payload came
+static uint8_t Receiving = 0;
+static uint16_t LastHeard;
+
+//////////////////////////////////////////////////////////////////////////
+// Settings
+//////////////////////////////////////////////////////////////////////////
+
+// Shortest ARD the data sheet allows at the rate with ADAPT_ACK_PAYLOAD long ACK payloads (see RadioConfig())
+static uint8_t AdaptDelay(uint8_t speed)
+{
+	// 500us without ACK payload, 250us more for every 8 bytes of it
+	if (speed == KBPS_250)
+		return ARD_US_500 + ((ADAPT_ACK_PAYLOAD + 7) / 8) * (ARD_US_750 - ARD_US_500);
+
+	if ((speed == MBPS_2 && ADAPT_ACK_PAYLOAD > 15) || (speed == MBPS_1 && ADAPT_ACK_PAYLOAD > 5))
+		return ARD_US_500;
+
+	return ARD_US_250;
+}
+
+// Puts the peer's settings on the device, only what changed is written
+static void AdaptApply(AdaptPeer* peer)
+{
+	RadioSetSpeed(Speeds[peer->speed]);
+	RadioSetPower(Powers[peer->power]);
+	RadioConfigRetransmission(AdaptDelay(Speeds[peer->speed]), ADAPT_ARC);
+}
+
+// Starts every peer at 2 Mbps and 0 dBm, the device gets peer 0's settings
+// NOTE: Make sure the device is in TX mode before calling this method
+void AdaptInitialize(void)
+{
+	// The silence fallback is timed with RADIO_TICKS(), make sure its timer runs
+	RADIO_TIMER_START();
+
+	memset(Peers, 0, sizeof(Peers));
+
+	for (uint8_t i = 0; i < ADAPT_PEERS; i++)
+	{
+		Peers[i].speed = SPEED_LEVELS - 1;
+		Peers[i].nextSpeed = SPEED_LEVELS - 1;
+		Peers[i].power = POWER_LEVELS - 1;
+		Peers[i].hold = 1;
+	}
+
+	Sending = ADAPT_IDLE;
+	Result = SEND_DONE;
+	Receiving = 0;
+	AdaptSelect(0);
+}
+
+// Packets sent from now on go to the peer (0..ADAPT_PEERS - 1), with its rate and power
+// Set TX_ADDR to the peer's address too, and don't call it while AdaptSendResult() is SEND_PENDING
+void AdaptSelect(uint8_t peer)
+{
+	if (peer >= ADAPT_PEERS)
+		peer = ADAPT_PEERS - 1;
+
+	Current = peer;
+	AdaptApply(&Peers[peer]);
+}
+
+// Copies where the peer's link is and what's been counted since AdaptInitialize()
+void AdaptGetStats(uint8_t peer, AdaptStats* stats)
+{
+	if (peer >= ADAPT_PEERS)
+		peer = ADAPT_PEERS - 1;
+
+	*stats = Peers[peer].stats;
+	stats->speed = Speeds[Peers[peer].speed];
+	stats->power = Powers[Peers[peer].power];
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Sender
+//////////////////////////////////////////////////////////////////////////
+
+// Sends the packet (up to 32 bytes) to the selected peer, after the notice of a new rate if there's one
+// Returns QUEUE_OK, QUEUE_FULL while the last one is on its way or the device is busy,
+// or ADAPT_RESERVED for a notice look-alike
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t AdaptSend(const uint8_t* data, uint8_t length)
+{
+	AdaptPeer* peer = &Peers[Current];
+
+	if (length == ADAPT_NOTICE_SIZE && data[0] == ADAPT_NOTICE)
+		return ADAPT_RESERVED;
+
+	if (Sending != ADAPT_IDLE)
+		return QUEUE_FULL;
+
+	if (length > MAXIMUM_PAYLOAD_SIZE)
+		length = MAXIMUM_PAYLOAD_SIZE;
+
+	memcpy(SendBuffer, data, length);
+	SendLength = length;
+
+	if (peer->nextSpeed != peer->speed)
+	{
+		uint8_t notice[ADAPT_NOTICE_SIZE] = { ADAPT_NOTICE, Speeds[peer->nextSpeed] };
+
+		if (!RadioSendBuffer(notice, ADAPT_NOTICE_SIZE))
+			return QUEUE_FULL;
+		Sending = ADAPT_NOTICE_ON;
+	}
+	else
+	{
+		if (!RadioSendBuffer(SendBuffer, SendLength))
+			return QUEUE_FULL;
+		Sending = ADAPT_DATA_ON;
+	}
+
+	return QUEUE_OK;
+}
+
+// SEND_PENDING while the packet (or the notice before it) is on its way, then SEND_DONE or SEND_FAILED
+uint8_t AdaptSendResult(void)
+{
+	return Sending == ADAPT_IDLE ? Result : SEND_PENDING;
+}
+
+// Takes the step the window asks for
+static void AdaptDecide(AdaptPeer* peer, uint8_t failed)
+{
+	uint16_t percent = peer->retransmissions * 100 / peer->packets;
+
+	peer->packets = 0;
+	peer->retransmissions = 0;
+
+	if (failed || percent > ADAPT_POOR_PERCENT)
+	{
+		// Last step went over the edge, wait longer before the next one
+		if (peer->probing && peer->hold < ADAPT_MAX_HOLD)
+			peer->hold *= 2;
+		peer->probing = 0;
+		peer->good = 0;
+
+		if (peer->power < POWER_LEVELS - 1)
+		{
+			peer->power++;
+			peer->stats.powerChanges++;
+		}
+		else if (peer->speed > 0)
+		{
+			peer->nextSpeed = peer->speed - 1;
+		}
+		return;
+	}
+
+	if (percent >= ADAPT_GOOD_PERCENT)
+	{
+		peer->probing = 0;
+		peer->good = 0;
+		return;
+	}
+
+	// Last step held
+	if (peer->probing && peer->hold > 1)
+		peer->hold /= 2;
+	peer->probing = 0;
+
+	if (++peer->good < peer->hold)
+		return;
+	peer->good = 0;
+
+	if (peer->speed < SPEED_LEVELS - 1)
+	{
+		peer->nextSpeed = peer->speed + 1;
+		peer->probing = 1;
+	}
+	else if (peer->power > 0)
+	{
+		peer->power--;
+		peer->stats.powerChanges++;
+		peer->probing = 1;
+	}
+}
+
+// Handles the end of the notice or the packet
+static void AdaptSent(void)
+{
+	uint8_t result = RadioSendResult();
+	AdaptPeer* peer = &Peers[Current];
+
+	if (result == SEND_PENDING)
+		return;
+
+	// Peer has taken the new rate, or hasn't heard of it
+	// A lower one is taken anyway, the link may be gone on this one - the peer comes down when it hears nothing
+	if (Sending == ADAPT_NOTICE_ON)
+	{
+		if (result == SEND_DONE || peer->nextSpeed < peer->speed)
+		{
+			peer->speed = peer->nextSpeed;
+			peer->stats.rateChanges++;
+			AdaptApply(peer);
+		}
+		else
+		{
+			peer->nextSpeed = peer->speed;
+		}
+
+		// Device has just finished the notice, it's refused only out of TX mode
+		if (RadioSendBuffer(SendBuffer, SendLength))
+		{
+			Sending = ADAPT_DATA_ON;
+			return;
+		}
+
+		Sending = ADAPT_IDLE;
+		Result = SEND_FAILED;
+		return;
+	}
+
+	Sending = ADAPT_IDLE;
+	Result = result;
+
+	// ARC_CNT is the whole ARC after MAX_RT
+	uint8_t retransmissions = RadioReadRegisterSingle(OBSERVE_TX) & 0x0F;
+
+	peer->stats.packets++;
+	peer->stats.retransmissions += retransmissions;
+	peer->retransmissions += retransmissions;
+	if (result == SEND_FAILED)
+		peer->stats.failed++;
+
+	if (++peer->packets < ADAPT_WINDOW && result == SEND_DONE)
+		return;
+
+	AdaptDecide(peer, result == SEND_FAILED);
+
+	// New power goes with the next packet, a new rate after its notice
+	AdaptApply(peer);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Receiver
+//////////////////////////////////////////////////////////////////////////
+
+// Changes the data rate in RX mode, listening starts over
+static void AdaptSwitchSpeed(uint8_t speed)
+{
+	CE_LOW;
+	RadioSetSpeed(speed);
+	CE_HIGH;
+}
+
+// Call with every payload received, before handling it
+// Returns 1 for a notice (the device is on the new rate now), 0 for the application's payloads
+// NOTE: Make sure the device is in RX mode before calling this method
+uint8_t AdaptReceived(uint8_t* data, uint8_t length)
+{
+	Receiving = 1;
+	LastHeard = RADIO_TICKS();
+
+	if (length != ADAPT_NOTICE_SIZE || data[0] != ADAPT_NOTICE)
+		return 0;
+
+	if ((data[1] == MBPS_2 || data[1] == MBPS_1 || data[1] == KBPS_250) && data[1] != (RadioReadShadow(RF_SETUP) & RATE_BITS))
+		AdaptSwitchSpeed(data[1]);
+
+	return 1;
+}
+
+// Goes one rate down after ADAPT_SILENCE_MS in RX mode without a payload, the sender may have lost the link
+static void AdaptListen(void)
+{
+	if (!Receiving || !(RadioReadShadow(CONFIG) & (1<<PRIM_RX)) ||
+		(uint16_t)(RADIO_TICKS() - LastHeard) < RADIO_US_TO_TICKS(ADAPT_SILENCE_MS * 1000UL))
+		return;
+
+	LastHeard = RADIO_TICKS();
+
+	uint8_t speed = RadioReadShadow(RF_SETUP) & RATE_BITS;
+	if (speed == MBPS_2)
+		AdaptSwitchSpeed(MBPS_1);
+	else if (speed == MBPS_1)
+		AdaptSwitchSpeed(KBPS_250);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Scheduler
+//////////////////////////////////////////////////////////////////////////
+
+// Follows the sent packets (sender), comes down to a lower rate when nothing arrives (receiver)
+// Should be called after RADIO_EVENT() in program's main loop
+void ADAPT_EVENT(void)
+{
+	if (Sending != ADAPT_IDLE)
+		AdaptSent();
+	else
+		AdaptListen();
+}
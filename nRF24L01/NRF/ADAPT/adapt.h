@@ -0,0 +1,125 @@
+// Link adaptation, the fastest data rate at the lowest TX power the link to each peer allows.
+// AdaptSend() sends like RadioSendBuffer() and reads ARC_CNT from OBSERVE_TX when the packet is done.
+// Every ADAPT_WINDOW packets (or at the first MAX_RT) the retransmissions per packet decide the step:
+// - poor (over ADAPT_POOR_PERCENT, or MAX_RT): more power, at 0 dBm a lower data rate
+// - good (under ADAPT_GOOD_PERCENT): a higher data rate, at 2 Mbps less power
+// A good step that turns out poor doubles the number of good windows the next one waits for (up to
+// ADAPT_MAX_HOLD), so the link doesn't keep falling over the same edge. SETUP_RETR follows the data
+// rate: ARD is the shortest the data sheet allows with ADAPT_ACK_PAYLOAD long ACK payloads.
+// Power changes only need the sender. Both ends have to be on the same data rate, so a new rate is
+// announced first with a notice [ADAPT_NOTICE][rate] at the old one. A higher rate is taken only when the
+// notice is acknowledged, a lower one in any case - the link may already be gone on the old rate.
+// The receiver passes everything through AdaptReceived() and switches on a notice. After ADAPT_SILENCE_MS
+// in RX mode without a payload it goes one rate down by itself, so it finds a sender that came down
+// without being heard; the sender has to send more often than that. One receiver follows one sender.
+// MAX_RT comes from the send result; PLOS_CNT is not used, every RF_CH write clears it.
+
+#ifndef ADAPT_H_
+#define ADAPT_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// Peers with their own rate and power (AdaptSelect())
+#ifndef ADAPT_PEERS
+#define ADAPT_PEERS 4
+#endif
+
+// Packets per decision
+#ifndef ADAPT_WINDOW
+#define ADAPT_WINDOW 16
+#endif
+
+// Retransmissions per 100 packets over which the link is poor, and under which it's good
+#ifndef ADAPT_POOR_PERCENT
+#define ADAPT_POOR_PERCENT 50
+#endif
+
+#ifndef ADAPT_GOOD_PERCENT
+#define ADAPT_GOOD_PERCENT 10
+#endif
+
+// Most good windows a step waits for
+#ifndef ADAPT_MAX_HOLD
+#define ADAPT_MAX_HOLD 8
+#endif
+
+// Retransmissions (ARC_XX), ARD is set from the data rate
+#ifndef ADAPT_ARC
+#define ADAPT_ARC ARC_5
+#endif
+
+// Longest ACK payload the peers send back
+#ifndef ADAPT_ACK_PAYLOAD
+#define ADAPT_ACK_PAYLOAD 0
+#endif
+
+// Time the receiver waits for a payload before it goes one rate down
+#ifndef ADAPT_SILENCE_MS
+#define ADAPT_SILENCE_MS 200
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Frames
+//////////////////////////////////////////////////////////////////////////
+
+// Notice: byte 0 - ADAPT_NOTICE, byte 1 - new data rate (MBPS_2, MBPS_1 or KBPS_250)
+// 2-byte payloads starting with ADAPT_NOTICE are reserved for it, AdaptSend() refuses them
+#define ADAPT_NOTICE		0xA5
+#define ADAPT_NOTICE_SIZE	2
+
+// AdaptSend() result besides QUEUE_OK and QUEUE_FULL, the packet would be taken for a notice
+#define ADAPT_RESERVED		2
+
+//////////////////////////////////////////////////////////////////////////
+// Types
+//////////////////////////////////////////////////////////////////////////
+
+// Where a peer's link is, and what's been counted since AdaptInitialize()
+typedef struct
+{
+	uint8_t speed;				// MBPS_2, MBPS_1 or KBPS_250
+	uint8_t power;				// POWER_DBM_XXX
+	uint16_t packets;			// Packets sent, notices not counted
+	uint16_t retransmissions;	// ARC_CNT summed up
+	uint16_t failed;			// MAX_RT
+	uint8_t rateChanges;
+	uint8_t powerChanges;
+} AdaptStats;
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+void AdaptInitialize(void);
+void AdaptSelect(uint8_t peer);
+uint8_t AdaptSend(const uint8_t* data, uint8_t length);
+uint8_t AdaptSendResult(void);
+uint8_t AdaptReceived(uint8_t* data, uint8_t length);
+void ADAPT_EVENT(void);
+void AdaptGetStats(uint8_t peer, AdaptStats* stats);
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+#if (ADAPT_PEERS < 1 || ADAPT_PEERS > 255)
+#error "ADAPT_PEERS must be between 1 and 255!"
+#endif
+
+#if (ADAPT_WINDOW < 1 || ADAPT_WINDOW > 255)
+#error "ADAPT_WINDOW must be between 1 and 255!"
+#endif
+
+#if (ADAPT_GOOD_PERCENT >= ADAPT_POOR_PERCENT)
+#error "ADAPT_GOOD_PERCENT must be below ADAPT_POOR_PERCENT!"
+#endif
+
+#if (ADAPT_ACK_PAYLOAD > 32)
+#error "ADAPT_ACK_PAYLOAD can't be over 32 bytes!"
+#endif
+
+#endif /* ADAPT_H_ */
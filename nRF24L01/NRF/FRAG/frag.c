@@ -0,0 +1,150 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "frag.h"
+
+// Message being sent, the caller's buffer is read as fragments are uploaded
+static const uint8_t* TxData;
+static uint16_t TxLength;
+static uint16_t TxOffset;
+static uint8_t TxIndex;
+static uint8_t TxId = 0;
+static uint8_t TxSending = 0;
+
+// Message being put together on a data pipe
+typedef struct
+{
+	uint8_t active;
+	uint8_t id;
+	uint8_t nextIndex;
+	uint16_t length;
+	uint32_t timestamp;
+	uint8_t data[FRAG_BUFFER_SIZE];
+} Reassembly;
+
+static Reassembly RxMessages[FRAG_PIPES];
+
+// Called with every complete message
+static void (*FragCallback)(uint8_t*, uint16_t, uint8_t);
+
+//////////////////////////////////////////////////////////////////////////
+// Sending
+//////////////////////////////////////////////////////////////////////////
+
+// Stream source, builds the next fragment
+static uint8_t FragSource(uint8_t* buffer)
+{
+	if (!TxSending)
+		return STREAM_END;
+
+	uint16_t left = TxLength - TxOffset;
+	uint8_t length = left > FRAG_DATA_SIZE ? FRAG_DATA_SIZE : left;
+
+	buffer[FRAG_ID] = TxId;
+	buffer[FRAG_INDEX] = TxIndex++;
+	memcpy(&buffer[FRAG_HEADER_SIZE], &TxData[TxOffset], length);
+
+	TxOffset += length;
+	if (TxOffset == TxLength)
+	{
+		buffer[FRAG_INDEX] |= FRAG_LAST;
+		TxSending = 0;
+	}
+
+	return FRAG_HEADER_SIZE + length;
+}
+
+// Starts sending the message, fragments go out back to back as TX FIFO frees up (RADIO_EVENT())
+// data must stay untouched until FragIsSending() returns 0
+// Returns QUEUE_OK, or QUEUE_FULL if the device is busy sending (try again after RADIO_EVENT())
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t FragSend(const uint8_t* data, uint16_t length)
+{
+	if (TxSending || length == 0)
+		return QUEUE_FULL;
+
+	if (length > FRAG_MAXIMUM_LENGTH)
+		length = FRAG_MAXIMUM_LENGTH;
+
+	TxData = data;
+	TxLength = length;
+	TxOffset = 0;
+	TxIndex = 0;
+	TxId++;
+	TxSending = 1;
+
+	if (!RadioStreamBegin(FragSource))
+	{
+		TxSending = 0;
+		return QUEUE_FULL;
+	}
+
+	return QUEUE_OK;
+}
+
+// Returns 1 while the message being sent still has fragments to upload
+uint8_t FragIsSending(void)
+{
+	return TxSending;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Receiving
+//////////////////////////////////////////////////////////////////////////
+
+// Registers function called with every complete message
+void RegisterFragCallback(void (*callback)(uint8_t*, uint16_t, uint8_t))
+{
+	FragCallback = callback;
+}
+
+// Feeds a received payload to the reassembly, can be registered with RegisterRadioCallback() directly
+void FragPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	if (pipe >= FRAG_PIPES || length <= FRAG_HEADER_SIZE)
+		return;
+
+	Reassembly* message = &RxMessages[pipe];
+	uint8_t index = data[FRAG_INDEX] & FRAG_INDEX_MASK;
+	uint32_t now = RADIO_TIMESTAMP();
+
+	// First fragment always starts over, whatever was there is lost
+	if (index == 0)
+	{
+		message->active = 1;
+		message->id = data[FRAG_ID];
+		message->nextIndex = 0;
+		message->length = 0;
+	}
+	else if (!message->active || message->id != data[FRAG_ID] || message->nextIndex != index ||
+			 (uint32_t)(now - message->timestamp) > FRAG_TIMEOUT)
+	{
+		// Fragment missing or too late
+		message->active = 0;
+		return;
+	}
+
+	length -= FRAG_HEADER_SIZE;
+	if (message->length + length > FRAG_BUFFER_SIZE)
+	{
+		message->active = 0;
+		return;
+	}
+
+	memcpy(&message->data[message->length], &data[FRAG_HEADER_SIZE], length);
+	message->length += length;
+	message->nextIndex++;
+	message->timestamp = now;
+
+	if (data[FRAG_INDEX] & FRAG_LAST)
+	{
+		message->active = 0;
+
+		if (FragCallback)
+			FragCallback(message->data, message->length, pipe);
+	}
+}
@@ -0,0 +1,66 @@
+// Messages longer than a single payload, split into fragments and put back together on the other side.
+// Every fragment starts with a 2-byte header: message id, then fragment index (bits 6:0) and
+// FRAG_LAST flag (bit 7). Fragments are streamed back to back (see RadioStreamBegin()) and must arrive
+// in order - a missing one drops the whole message.
+
+#ifndef FRAG_H_
+#define FRAG_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// Longest message that can be received (RAM used per pipe)
+#ifndef FRAG_BUFFER_SIZE
+#define FRAG_BUFFER_SIZE 256
+#endif
+
+// Data pipes 0..FRAG_PIPES-1 get a reassembly buffer, fragments from the others are dropped
+#ifndef FRAG_PIPES
+#define FRAG_PIPES 1
+#endif
+
+// Partial message is dropped when the next fragment comes later than that, in RADIO_TIMESTAMP() units
+#ifndef FRAG_TIMEOUT
+#define FRAG_TIMEOUT 50000
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Header
+//////////////////////////////////////////////////////////////////////////
+#define FRAG_HEADER_SIZE 2
+#define FRAG_DATA_SIZE (MAXIMUM_PAYLOAD_SIZE - FRAG_HEADER_SIZE)
+
+#define FRAG_ID		0
+#define FRAG_INDEX	1
+
+#define FRAG_LAST 0x80
+#define FRAG_INDEX_MASK 0x7F
+
+// Longest message that can be sent
+#define FRAG_MAXIMUM_LENGTH ((FRAG_INDEX_MASK + 1) * FRAG_DATA_SIZE)
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+uint8_t FragSend(const uint8_t* data, uint16_t length);
+uint8_t FragIsSending(void);
+void FragPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe);
+void RegisterFragCallback(void (*callback)(uint8_t*, uint16_t, uint8_t));
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+#if (FRAG_PIPES < 1 || FRAG_PIPES > 6)
+#error "FRAG_PIPES must be between 1 and 6!"
+#endif
+
+#if (FRAG_BUFFER_SIZE < FRAG_DATA_SIZE || FRAG_BUFFER_SIZE > FRAG_MAXIMUM_LENGTH)
+#error "FRAG_BUFFER_SIZE must be between FRAG_DATA_SIZE and FRAG_MAXIMUM_LENGTH!"
+#endif
+
+#endif /* FRAG_H_ */
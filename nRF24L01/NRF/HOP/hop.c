@@ -0,0 +1,328 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "hop.h"
+
+// Period has to fit in half of RADIO_TICKS() range
+#if (HOP_PERIOD_US * 1000ULL / RADIO_TICK_NS > 32767)
+#error "HOP_PERIOD_US is too long for RADIO_TICKS(), use a bigger prescaler!"
+#endif
+
+// Time between the leader's hop and the follower reading its beacon: settling, TX start, the beacon on air
+#define HOP_BEACON_LAG_US (HOP_SETTLE_US + 200)
+
+const uint8_t HopDefaultTable[16] PROGMEM =
+{
+	2, 42, 12, 52, 22, 62, 32, 72, 7, 47, 17, 57, 27, 67, 37, 77
+};
+
+typedef struct
+{
+	uint8_t slots;		// Slots it's been tried in
+	uint8_t length;
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+} HopMessage;
+
+static uint8_t Role = 0;
+
+// Hop table (flash), slot the device is in and RADIO_TICKS() when it started
+static const uint8_t* Table;
+static uint8_t TableLength;
+static uint8_t Slot;
+static uint16_t SlotStart;
+
+// Leader - messages waiting, oldest at Head
+static HopMessage Queue[HOP_QUEUE_SIZE];
+static uint8_t Head = 0;
+static uint8_t Count = 0;
+
+// Leader - beacon of the slot hasn't been sent, something is on its way, the head message waits for the next slot
+static uint8_t BeaconDue = 0;
+static uint8_t Sending = 0;
+static uint8_t HeadTried = 0;
+
+// Follower - something has been received in the slot, slots in a row without anything, waiting for a beacon
+static uint8_t Heard = 0;
+static uint8_t Missed = 0;
+static uint8_t Parked = 0;
+
+static HopStats Stats;
+
+// Called with every message received (follower)
+static void (*HopCallback)(uint8_t*, uint8_t, uint8_t);
+
+// Registers function called with every message received, beacons are not passed on
+void RegisterHopCallback(void (*callback)(uint8_t*, uint8_t, uint8_t))
+{
+	HopCallback = callback;
+}
+
+// Goes to the slot, only RF_CH is written
+static void HopTo(uint8_t slot)
+{
+	Slot = slot;
+
+	// Listening starts over on the new channel, the leader is in standby between packets
+	if (Role == HOP_FOLLOWER)
+		CE_LOW;
+	RadioSetChannel(pgm_read_byte(&Table[slot]));
+	if (Role == HOP_FOLLOWER)
+		CE_HIGH;
+}
+
+// Moves SlotStart over the slots that have passed, returns their number
+// Both ends skip the same slots when the main loop has been away, as long as it's less than half of RADIO_TICKS() range
+static uint8_t HopElapsed(void)
+{
+	uint16_t elapsed = RADIO_TICKS() - SlotStart;
+
+	if (elapsed < RADIO_US_TO_TICKS(HOP_PERIOD_US))
+		return 0;
+
+	uint8_t slots = elapsed / RADIO_US_TO_TICKS(HOP_PERIOD_US);
+	SlotStart += slots * RADIO_US_TO_TICKS(HOP_PERIOD_US);
+	Stats.slots += slots;
+
+	return slots;
+}
+
+// Starts hopping over the table (in flash, e.g. HopDefaultTable) from its first channel
+// Leader: NOTE: Make sure the device is in TX mode before calling this method
+// Follower: NOTE: Make sure the device is in RX mode before calling this method, takes over the radio callback
+void HopStart(uint8_t role, const uint8_t* table, uint8_t length)
+{
+	// Slots are timed with RADIO_TICKS(), make sure its timer runs
+	RADIO_TIMER_START();
+
+	Role = role;
+	Table = table;
+	TableLength = length;
+
+	Head = 0;
+	Count = 0;
+	Sending = 0;
+	HeadTried = 0;
+	BeaconDue = 1;
+	Heard = 0;
+	Missed = 0;
+	Parked = 0;
+	memset(&Stats, 0, sizeof(Stats));
+
+	// Whole message with retransmissions has to fit in HOP_GUARD_US
+	if (role == HOP_LEADER)
+		RadioConfigRetransmission(ARD_US_500, ARC_3);
+	else
+		RegisterRadioCallback(HopPacketReceived);
+
+	SlotStart = RADIO_TICKS();
+	HopTo(0);
+}
+
+// Stops hopping, the device stays on the channel it's on
+// Messages still queued are dropped
+void HopStop(void)
+{
+	Role = 0;
+	Count = 0;
+}
+
+// Copies what's been counted since HopStart()
+void HopGetStats(HopStats* stats)
+{
+	*stats = Stats;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Leader
+//////////////////////////////////////////////////////////////////////////
+
+// Queues the message (up to 32 bytes), it's sent from HOP_EVENT() within the slots
+// Returns QUEUE_OK, QUEUE_FULL if there's no room in the queue, or HOP_REFUSED for an empty message
+// or a beacon look-alike - the radio won't send an empty one, it would hold up the queue for good
+uint8_t HopSend(const uint8_t* data, uint8_t length)
+{
+	if (length == 0 || (length == HOP_BEACON_SIZE && data[0] == HOP_BEACON))
+		return HOP_REFUSED;
+
+	if (Count == HOP_QUEUE_SIZE)
+		return QUEUE_FULL;
+
+	if (length > MAXIMUM_PAYLOAD_SIZE)
+		length = MAXIMUM_PAYLOAD_SIZE;
+
+	HopMessage* message = &Queue[(Head + Count) % HOP_QUEUE_SIZE];
+	message->slots = 0;
+	message->length = length;
+	memcpy(message->data, data, length);
+	Count++;
+
+	return QUEUE_OK;
+}
+
+// Messages waiting, including the one on its way
+uint8_t HopPending(void)
+{
+	return Count;
+}
+
+// Takes the head message off the queue
+static void HopDequeue(void)
+{
+	Head = (Head + 1) % HOP_QUEUE_SIZE;
+	Count--;
+	HeadTried = 0;
+}
+
+// Handles the end of the last transmission
+static void HopSent(void)
+{
+	uint8_t result = RadioSendResult();
+
+	if (result == SEND_PENDING)
+		return;
+
+	Sending = 0;
+
+	// Beacon, nobody acknowledges it
+	if (BeaconDue)
+	{
+		BeaconDue = 0;
+		return;
+	}
+
+	if (result == SEND_DONE)
+	{
+		Stats.sent++;
+		HopDequeue();
+		return;
+	}
+
+	// Channel is taken, try on the next ones
+	if (Queue[Head].slots >= HOP_RETRIES)
+	{
+		Stats.failed++;
+		HopDequeue();
+	}
+	else
+	{
+		Stats.retried++;
+		HeadTried = 1;
+	}
+}
+
+static void HopLeaderEvent(void)
+{
+	if (Sending)
+		HopSent();
+
+	// Channel can't change under a packet, RADIO_NONBLOCKING - RADIO_EVENT() has to finish the last mode change
+	if (Sending || !RadioIsReady())
+		return;
+
+	uint8_t slots = HopElapsed();
+
+	if (slots)
+	{
+		BeaconDue = 1;
+		HeadTried = 0;
+		HopTo((Slot + slots) % TableLength);
+		return;
+	}
+
+	uint16_t inSlot = RADIO_TICKS() - SlotStart;
+
+	if (inSlot < RADIO_US_TO_TICKS(HOP_SETTLE_US))
+		return;
+
+	if (BeaconDue)
+	{
+		uint8_t beacon[HOP_BEACON_SIZE] = { HOP_BEACON, Slot };
+
+		Sending = RadioSendBufferNoAck(beacon, HOP_BEACON_SIZE);
+		return;
+	}
+
+	if (Count == 0 || HeadTried || inSlot > RADIO_US_TO_TICKS(HOP_PERIOD_US - HOP_GUARD_US))
+		return;
+
+	// Slot counts only if the message got on air
+	HopMessage* message = &Queue[Head];
+	Sending = RadioSendBuffer(message->data, message->length);
+	message->slots += Sending;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Follower
+//////////////////////////////////////////////////////////////////////////
+
+// Handles a received payload, registered by HopStart() as the radio callback of the follower
+void HopPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	if (Role != HOP_FOLLOWER)
+		return;
+
+	Heard = 1;
+	Missed = 0;
+
+	if (length == HOP_BEACON_SIZE && data[0] == HOP_BEACON && data[1] < TableLength)
+	{
+		// Leader's slot has started a bit earlier
+		SlotStart = RADIO_TICKS() - RADIO_US_TO_TICKS(HOP_BEACON_LAG_US);
+
+		if (Parked)
+		{
+			Parked = 0;
+			Stats.resyncs++;
+		}
+
+		if (data[1] != Slot)
+			HopTo(data[1]);
+		return;
+	}
+
+	if (HopCallback)
+		HopCallback(data, length, pipe);
+}
+
+static void HopFollowerEvent(void)
+{
+	uint8_t slots = HopElapsed();
+
+	// Waiting on the first channel for the leader to come by
+	if (slots == 0 || Parked)
+		return;
+
+	// Slots passed without this one getting a look at them count as missed too
+	uint8_t missed = Heard ? slots - 1 : slots;
+	Stats.missed += missed;
+	Missed = Heard ? missed : Missed + missed;
+	Heard = 0;
+
+	if (Missed >= HOP_MAX_MISSED)
+	{
+		Parked = 1;
+		HopTo(0);
+		return;
+	}
+
+	HopTo((Slot + slots) % TableLength);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Scheduler
+//////////////////////////////////////////////////////////////////////////
+
+// Hops, sends beacons and queued messages (leader)
+// Should be called after RADIO_EVENT() in program's main loop
+void HOP_EVENT(void)
+{
+	if (Role == HOP_LEADER)
+		HopLeaderEvent();
+	else if (Role == HOP_FOLLOWER)
+		HopFollowerEvent();
+}
@@ -0,0 +1,119 @@
+// Frequency hopping, so a link doesn't depend on one channel staying clean.
+// Both ends walk the same hop table (in flash) and change channel every HOP_PERIOD_US. Hopping is only
+// an RF_CH write (RadioSetChannel()), the device stays in its mode.
+// The leader (transmitter) keeps the time: it sends a beacon with the slot number HOP_SETTLE_US after
+// each hop, then its queued messages until HOP_GUARD_US before the next hop. A message that isn't
+// acknowledged is sent again in the next slots, on other channels, up to HOP_RETRIES times.
+// The follower (receiver) hops on its own clock and takes the slot number and timing from every beacon.
+// After HOP_MAX_MISSED slots without hearing anything it stops on the first channel of the table and
+// waits for the leader to come by.
+
+#ifndef HOP_H_
+#define HOP_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// Time on each channel
+#ifndef HOP_PERIOD_US
+#define HOP_PERIOD_US 20000
+#endif
+
+// Time the leader waits after a hop before sending, covers the follower's clock and main loop
+#ifndef HOP_SETTLE_US
+#define HOP_SETTLE_US 500
+#endif
+
+// No new message is started this close to the next hop, covers a message with all retransmissions
+// (HopStart() sets ARD_US_500 and ARC_3 on the leader)
+#ifndef HOP_GUARD_US
+#define HOP_GUARD_US 3000
+#endif
+
+// Slots a message is tried in before it's dropped
+#ifndef HOP_RETRIES
+#define HOP_RETRIES 4
+#endif
+
+// Slots in a row without anything received before the follower stops hopping and waits for a beacon
+#ifndef HOP_MAX_MISSED
+#define HOP_MAX_MISSED 3
+#endif
+
+// Messages the leader queues (RAM used: 33 bytes per message)
+#ifndef HOP_QUEUE_SIZE
+#define HOP_QUEUE_SIZE 4
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Frames
+//////////////////////////////////////////////////////////////////////////
+
+// Beacon: byte 0 - HOP_BEACON, byte 1 - slot (index in the hop table)
+// 2-byte messages starting with HOP_BEACON are reserved for it, HopSend() refuses them
+#define HOP_BEACON		0xB7
+#define HOP_BEACON_SIZE	2
+
+// HopSend() result besides QUEUE_OK and QUEUE_FULL, the message is empty or would be taken for a beacon
+#define HOP_REFUSED		2
+
+// Roles
+#define HOP_LEADER		1
+#define HOP_FOLLOWER	2
+
+//////////////////////////////////////////////////////////////////////////
+// Types
+//////////////////////////////////////////////////////////////////////////
+
+// Counted since HopStart()
+typedef struct
+{
+	uint16_t slots;			// Hop periods passed
+	uint16_t missed;		// Slots nothing was received in (follower)
+	uint16_t resyncs;		// Times the follower found the leader again after it stopped hopping
+	uint16_t sent;			// Messages acknowledged (leader)
+	uint16_t retried;		// Messages sent again in a later slot (leader)
+	uint16_t failed;		// Messages dropped after HOP_RETRIES slots (leader)
+} HopStats;
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+void HopStart(uint8_t role, const uint8_t* table, uint8_t length);
+void HopStop(void);
+uint8_t HopSend(const uint8_t* data, uint8_t length);
+uint8_t HopPending(void);
+void HOP_EVENT(void);
+void HopPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe);
+void RegisterHopCallback(void (*callback)(uint8_t*, uint8_t, uint8_t));
+void HopGetStats(HopStats* stats);
+
+//////////////////////////////////////////////////////////////////////////
+// Variables
+//////////////////////////////////////////////////////////////////////////
+
+// 16 channels spread over 2..77, consecutive ones at least 30 MHz apart (wider than a WiFi channel)
+extern const uint8_t HopDefaultTable[16] PROGMEM;
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+#if (HOP_SETTLE_US + HOP_GUARD_US >= HOP_PERIOD_US)
+#error "HOP_PERIOD_US must be longer than HOP_SETTLE_US and HOP_GUARD_US!"
+#endif
+
+#if (HOP_QUEUE_SIZE < 1 || HOP_QUEUE_SIZE > 255)
+#error "HOP_QUEUE_SIZE must be between 1 and 255!"
+#endif
+
+#if (HOP_RETRIES < 1 || HOP_MAX_MISSED < 1)
+#error "HOP_RETRIES and HOP_MAX_MISSED must be at least 1!"
+#endif
+
+#endif /* HOP_H_ */
@@ -0,0 +1,312 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "hub.h"
+
+// No node's message is with the radio
+#define HUB_NONE 0xFF
+
+typedef struct
+{
+	HubNodeStats stats;
+	uint8_t expected;		// Next sequence number
+	uint8_t seen;			// Set by the first frame, sequence numbers mean nothing before that
+	uint8_t pending;		// Length of the message waiting for the node (with its id), 0 if none
+	uint8_t downlink[MAXIMUM_PAYLOAD_SIZE];
+} HubNode;
+
+// Node table, in the order nodes were added
+static HubNode Nodes[HUB_MAX_NODES];
+static uint8_t NodeCount = 0;
+
+// Node whose message the pipe's next ACK carries, and where to start looking for the next one
+static uint8_t PipeNode[6];
+static uint8_t PipeTurn[6];
+
+// Frames from ids not in the table, or on another pipe than the node's
+static uint16_t Unknown = 0;
+
+// Leaf side
+static uint8_t Leaf = 0;
+static uint8_t LeafId;
+static uint8_t LeafSequence;
+
+// Called with every frame delivered (hub), or every message for this node (leaf)
+static void (*HubCallback)(uint8_t, uint8_t*, uint8_t);
+
+// Full address of a pipe, LSB first
+static void HubPipeAddress(uint8_t pipe, uint8_t* address)
+{
+	address[0] = HUB_PIPE_LSB + pipe;
+	memcpy(&address[1], HUB_ADDRESS_BASE, 4);
+}
+
+static HubNode* HubFind(uint8_t id)
+{
+	for (uint8_t i = 0; i < NodeCount; i++)
+		if (Nodes[i].stats.id == id)
+			return &Nodes[i];
+
+	return NULL;
+}
+
+// Registers function called with every frame from a node (hub), or every message from the hub (leaf)
+void RegisterHubCallback(void (*callback)(uint8_t id, uint8_t* data, uint8_t length))
+{
+	HubCallback = callback;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Hub
+//////////////////////////////////////////////////////////////////////////
+
+// Makes the device the hub: all six pipes with auto ACK, dynamic width and ACK payloads
+// Takes over the radio callback, frames go to RegisterHubCallback()
+// NOTE: Call RadioEnterRxMode() afterwards, the hub only listens
+void HubInitialize(void)
+{
+	RadioConfigImage image;
+	memcpy_P(&image, &RadioDefaultConfig, sizeof(image));
+
+	HubPipeAddress(DATA_PIPE_0, image.rxAddressP0);
+	HubPipeAddress(DATA_PIPE_0, image.txAddress);
+	HubPipeAddress(DATA_PIPE_1, image.rxAddressP1);
+	for (uint8_t i = 0; i < 4; i++)
+		image.rxAddressLsb[i] = HUB_PIPE_LSB + DATA_PIPE_2 + i;
+
+	image.addressWidth = AW_BYTES_5;
+	image.enabledPipes = 0b00111111;
+	image.autoAck = 0b00111111;
+	image.dynamicPayload = 0b00111111;
+	image.feature = (1<<EN_DPL) | (1<<EN_ACK_PAY);
+
+	RadioCommitConfig(&image);
+
+	Leaf = 0;
+	memset(PipeNode, HUB_NONE, sizeof(PipeNode));
+	RegisterRadioCallback(HubPacketReceived);
+}
+
+// Adds the node to the table and puts it on the least used pipe (lowest one if more are equal)
+// Returns the pipe, the one it already has if it's in the table, or HUB_FULL
+uint8_t HubAddNode(uint8_t id)
+{
+	HubNode* node = HubFind(id);
+	if (node)
+		return node->stats.pipe;
+
+	if (NodeCount == HUB_MAX_NODES)
+		return HUB_FULL;
+
+	uint8_t used[6] = { 0 };
+	for (uint8_t i = 0; i < NodeCount; i++)
+		used[Nodes[i].stats.pipe]++;
+
+	uint8_t pipe = 0;
+	for (uint8_t i = 1; i < 6; i++)
+		if (used[i] < used[pipe])
+			pipe = i;
+
+	node = &Nodes[NodeCount++];
+	memset(node, 0, sizeof(HubNode));
+	node->stats.id = id;
+	node->stats.pipe = pipe;
+
+	return pipe;
+}
+
+// Fills the 5-byte address a node in the table has to send to (for HubJoin() on the node)
+void HubNodeAddress(uint8_t id, uint8_t* address)
+{
+	HubNode* node = HubFind(id);
+	if (node)
+		HubPipeAddress(node->stats.pipe, address);
+}
+
+// Number of nodes in the table
+uint8_t HubNodeCount(void)
+{
+	return NodeCount;
+}
+
+// Node's statistics, index goes from 0 to HubNodeCount() - 1
+const HubNodeStats* HubGetNode(uint8_t index)
+{
+	if (index >= NodeCount)
+		return NULL;
+
+	return &Nodes[index].stats;
+}
+
+// Frames from nodes that aren't in the table
+uint16_t HubUnknownFrames(void)
+{
+	return Unknown;
+}
+
+// Gives the radio the message of the next node on the pipe that has one
+// Nodes are taken in turns, starting after the one served last
+static void HubServePipe(uint8_t pipe)
+{
+	if (PipeNode[pipe] != HUB_NONE)
+		return;
+
+	for (uint8_t i = 0; i < NodeCount; i++)
+	{
+		uint8_t index = (PipeTurn[pipe] + i) % NodeCount;
+		HubNode* node = &Nodes[index];
+
+		if (node->stats.pipe != pipe || !node->pending)
+			continue;
+
+		// Radio's queue is full, the next frame on the pipe tries again
+		if (RadioQueueAckPayload(pipe, node->downlink, node->pending) != QUEUE_OK)
+			return;
+
+		PipeNode[pipe] = index;
+		PipeTurn[pipe] = index + 1;
+		return;
+	}
+}
+
+// Queues the message (up to 31 bytes) for the node, it goes out with the ACK of one of the node's next frames
+// Returns QUEUE_OK, or QUEUE_FULL if the node isn't in the table or its previous message hasn't gone out
+uint8_t HubSend(uint8_t id, const uint8_t* data, uint8_t length)
+{
+	HubNode* node = HubFind(id);
+	if (!node || node->pending)
+		return QUEUE_FULL;
+
+	if (length > HUB_DOWNLINK_SIZE)
+		length = HUB_DOWNLINK_SIZE;
+
+	node->downlink[0] = id;
+	memcpy(&node->downlink[1], data, length);
+	node->pending = length + 1;
+
+	HubServePipe(node->stats.pipe);
+
+	return QUEUE_OK;
+}
+
+// Takes a frame from a node in the table
+static void HubFrameReceived(HubNode* node, uint8_t* data, uint8_t length)
+{
+	HubNodeStats* stats = &node->stats;
+	uint8_t sequence = data[1];
+
+	if (node->seen && sequence == (uint8_t)(node->expected - 1))
+	{
+		stats->duplicates++;
+		return;
+	}
+
+	// Anything far behind means the node has started over
+	uint8_t skipped = sequence - node->expected;
+	if (node->seen && skipped < 0x80)
+		stats->lost += skipped;
+
+	node->seen = 1;
+	node->expected = sequence + 1;
+	stats->packets++;
+	stats->lastSeen = RADIO_TIMESTAMP();
+
+	if (HubCallback)
+		HubCallback(stats->id, &data[HUB_HEADER_SIZE], length - HUB_HEADER_SIZE);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Leaf
+//////////////////////////////////////////////////////////////////////////
+
+// Makes the device a leaf sending to the hub on the address from HubNodeAddress()
+// Takes over the radio callback, messages from the hub go to RegisterHubCallback()
+// NOTE: Call RadioEnterTxMode() afterwards
+void HubJoin(uint8_t id, const uint8_t* address)
+{
+	RadioConfigImage image;
+	memcpy_P(&image, &RadioDefaultConfig, sizeof(image));
+
+	memcpy(image.txAddress, address, 5);
+	memcpy(image.rxAddressP0, address, 5);
+	image.addressWidth = AW_BYTES_5;
+	image.dynamicPayload |= (1<<DPL_P0);
+	image.feature |= (1<<EN_DPL) | (1<<EN_ACK_PAY);
+
+	RadioCommitConfig(&image);
+
+	Leaf = 1;
+	LeafId = id;
+	LeafSequence = 0;
+	RegisterRadioCallback(HubPacketReceived);
+}
+
+// Sends the frame (up to 30 bytes) to the hub, whatever the hub has for this node comes back with the ACK
+// Returns 0 if the device is busy or not in TX mode (see RadioSendBuffer())
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t HubLeafSend(const uint8_t* data, uint8_t length)
+{
+	uint8_t frame[MAXIMUM_PAYLOAD_SIZE];
+
+	if (length > HUB_DATA_SIZE)
+		length = HUB_DATA_SIZE;
+
+	frame[0] = LeafId;
+	frame[1] = LeafSequence;
+	memcpy(&frame[HUB_HEADER_SIZE], data, length);
+
+	if (!RadioSendBuffer(frame, HUB_HEADER_SIZE + length))
+		return 0;
+
+	LeafSequence++;
+	return 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Receiving
+//////////////////////////////////////////////////////////////////////////
+
+// Handles a received payload, registered by HubInitialize() and HubJoin() as the radio callback
+void HubPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	// Leaf - ACK payload from the hub, nodes sharing the pipe get each other's messages too
+	if (Leaf)
+	{
+		if (length >= 1 && data[0] == LeafId && HubCallback)
+			HubCallback(LeafId, &data[1], length - 1);
+		return;
+	}
+
+	HubNode* node = length >= HUB_HEADER_SIZE ? HubFind(data[0]) : NULL;
+
+	// Hub - ACK of this frame carried the pipe's message, unless it was still waiting for room in the device.
+	// If another node on the pipe got it, it's given again
+	if (PipeNode[pipe] != HUB_NONE && !RadioAckPayloadWaiting(pipe))
+	{
+		HubNode* served = &Nodes[PipeNode[pipe]];
+		if (served == node)
+		{
+			served->pending = 0;
+			served->stats.downlinks++;
+		}
+		PipeNode[pipe] = HUB_NONE;
+	}
+
+	if (node && node->stats.pipe == pipe)
+	{
+		HubFrameReceived(node, data, length);
+
+		// Node that has just sent is the least likely to send next, start after it
+		PipeTurn[pipe] = node - Nodes + 1;
+	}
+	else
+		Unknown++;
+
+	// Loaded once RX FIFO is empty, so it goes with the next frame
+	HubServePipe(pipe);
+}
@@ -0,0 +1,92 @@
+// Star network: one receiver (the hub) collecting from many leaf nodes, like a sensor concentrator.
+// All six data pipes listen, on addresses sharing HUB_ADDRESS_BASE and differing in the LSB (which is how
+// the device compares pipes 2..5). HubAddNode() puts a node on the least used pipe, so up to six nodes get
+// a pipe of their own and the rest share them. Every leaf frame starts with the node id and a sequence
+// number, which tells nodes on a shared pipe apart (and keeps their frames apart in the device's PID/CRC
+// duplicate check) and gives per-node packet, loss and duplicate counts.
+// The hub never transmits, data for a node rides on the ACK of the node's next frame (ACK payload, one
+// per pipe at a time). Nodes sharing a pipe take turns, so a busy one can't starve the others, and a message
+// that went with another node's ACK is given again.
+// Leaves use HubJoin() and HubLeafSend(), data from the hub ends in the same callback as on the hub.
+
+#ifndef HUB_H_
+#define HUB_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// Nodes the hub keeps in its table (RAM used: 49 bytes per node)
+#ifndef HUB_MAX_NODES
+#define HUB_MAX_NODES 8
+#endif
+
+// Address bytes shared by all pipes, 4 characters
+#ifndef HUB_ADDRESS_BASE
+#define HUB_ADDRESS_BASE "HUB0"
+#endif
+
+// Address LSB of pipe 0, pipe n uses HUB_PIPE_LSB + n
+#ifndef HUB_PIPE_LSB
+#define HUB_PIPE_LSB 0xC1
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Frames
+//////////////////////////////////////////////////////////////////////////
+
+// Leaf to hub: byte 0 - node id, byte 1 - sequence number
+// Hub to leaf (ACK payload): byte 0 - node id
+#define HUB_HEADER_SIZE 2
+#define HUB_DATA_SIZE (MAXIMUM_PAYLOAD_SIZE - HUB_HEADER_SIZE)
+#define HUB_DOWNLINK_SIZE (MAXIMUM_PAYLOAD_SIZE - 1)
+
+// HubAddNode() result when the table is full
+#define HUB_FULL 0xFF
+
+//////////////////////////////////////////////////////////////////////////
+// Types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	uint8_t id;
+	uint8_t pipe;
+	uint16_t packets;		// Frames delivered
+	uint16_t lost;			// Sequence numbers skipped
+	uint16_t duplicates;	// Frames received again (lost ACK)
+	uint16_t downlinks;		// Messages that went out with an ACK
+	uint32_t lastSeen;		// RADIO_TIMESTAMP() of the last frame
+} HubNodeStats;
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+void HubInitialize(void);
+uint8_t HubAddNode(uint8_t id);
+void HubNodeAddress(uint8_t id, uint8_t* address);
+uint8_t HubSend(uint8_t id, const uint8_t* data, uint8_t length);
+uint8_t HubNodeCount(void);
+const HubNodeStats* HubGetNode(uint8_t index);
+uint16_t HubUnknownFrames(void);
+void HubJoin(uint8_t id, const uint8_t* address);
+uint8_t HubLeafSend(const uint8_t* data, uint8_t length);
+void HubPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe);
+void RegisterHubCallback(void (*callback)(uint8_t id, uint8_t* data, uint8_t length));
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+#if (HUB_MAX_NODES < 1 || HUB_MAX_NODES > 254)
+#error "HUB_MAX_NODES must be between 1 and 254!"
+#endif
+
+#if (HUB_PIPE_LSB > 0xFA)
+#error "HUB_PIPE_LSB must leave room for six pipes!"
+#endif
+
+#endif /* HUB_H_ */
@@ -0,0 +1,287 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "link.h"
+
+// Sender's frame states
+#define FRAME_QUEUED	1	// Waiting to be uploaded (new or to be sent again)
+#define FRAME_SENT		2	// Uploaded, waiting for acknowledgment
+#define FRAME_ACKED		3	// Acknowledged out of order, waiting for the ones before it
+
+typedef struct
+{
+	uint8_t state;
+	uint8_t waited;		// Acknowledgments received since it was sent
+	uint8_t length;
+	uint8_t data[LINK_DATA_SIZE];
+} LinkFrame;
+
+// Sender window, frame with sequence number n is at n % LINK_WINDOW
+static LinkFrame Frames[LINK_WINDOW];
+
+// Oldest frame not acknowledged and the sequence number of the next new frame
+static uint8_t Base = 0;
+static uint8_t Next = 0;
+
+// Set while the radio is streaming frames from LinkSource()
+static uint8_t Streaming = 0;
+
+// Polls sent since the last acknowledgment
+static uint8_t Polls = 0;
+
+// Windows dropped because the peer stopped answering
+static uint16_t Failures = 0;
+
+// Receiver state of a pipe
+typedef struct
+{
+	uint8_t expected;						// Next sequence number to deliver
+	uint16_t received;						// Bit n - frame expected + 1 + n is held below
+	uint8_t length[LINK_WINDOW];
+	uint8_t data[LINK_WINDOW][LINK_DATA_SIZE];
+} LinkReceiver;
+
+static LinkReceiver Receivers[LINK_PIPES];
+
+// Called with every frame, in order
+static void (*LinkCallback)(uint8_t*, uint8_t, uint8_t);
+
+// Enables what the transport needs from the radio and takes over its receive callback
+void LinkInitialize(void)
+{
+	RadioSetAckPayload(1);
+	RegisterRadioCallback(LinkPacketReceived);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Sending
+//////////////////////////////////////////////////////////////////////////
+
+// Stream source: frames waiting for upload oldest first, polls while waiting for acknowledgments
+static uint8_t LinkSource(uint8_t* buffer)
+{
+	for (uint8_t sequence = Base; sequence != Next; sequence++)
+	{
+		LinkFrame* frame = &Frames[sequence % LINK_WINDOW];
+		if (frame->state != FRAME_QUEUED)
+			continue;
+
+		frame->state = FRAME_SENT;
+		frame->waited = 0;
+
+		buffer[0] = LINK_DATA;
+		buffer[1] = sequence;
+		memcpy(&buffer[LINK_HEADER_SIZE], frame->data, frame->length);
+		return LINK_HEADER_SIZE + frame->length;
+	}
+
+	// Everything acknowledged
+	if (Base == Next)
+	{
+		Streaming = 0;
+		return STREAM_END;
+	}
+
+	// Nobody answers, give up on the window
+	if (++Polls > LINK_MAX_POLLS)
+	{
+		Base = Next;
+		Polls = 0;
+		Failures++;
+		Streaming = 0;
+		return STREAM_END;
+	}
+
+	// Acknowledgments come back with ACKs, something has to be sent to get them
+	buffer[0] = LINK_POLL;
+	buffer[1] = Base;
+	return LINK_HEADER_SIZE;
+}
+
+// Queues the frame (up to 30 bytes), it's delivered in order unless the peer stops answering
+// Returns QUEUE_OK, or QUEUE_FULL if the window is full or the radio is busy (try again after RADIO_EVENT())
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t LinkSend(const uint8_t* data, uint8_t length)
+{
+	if ((uint8_t)(Next - Base) == LINK_WINDOW)
+		return QUEUE_FULL;
+
+	if (length > LINK_DATA_SIZE)
+		length = LINK_DATA_SIZE;
+
+	LinkFrame* frame = &Frames[Next % LINK_WINDOW];
+	frame->state = FRAME_QUEUED;
+	frame->length = length;
+	memcpy(frame->data, data, length);
+	Next++;
+
+	if (Streaming)
+	{
+		RadioStreamRefill();
+		return QUEUE_OK;
+	}
+
+	Streaming = 1;
+	Polls = 0;
+	if (!RadioStreamBegin(LinkSource))
+	{
+		Streaming = 0;
+		Next--;
+		return QUEUE_FULL;
+	}
+
+	return QUEUE_OK;
+}
+
+// Frames queued or in flight
+uint8_t LinkPending(void)
+{
+	return Next - Base;
+}
+
+// Number of times frames were dropped because the peer stopped answering
+uint16_t LinkFailures(void)
+{
+	return Failures;
+}
+
+// Handles receiver state that came with an ACK
+static void LinkAcknowledged(uint8_t expected, uint16_t received)
+{
+	uint8_t resend = 0;
+
+	Polls = 0;
+
+	// Everything before expected has been delivered
+	if ((uint8_t)(expected - Base) <= (uint8_t)(Next - Base))
+		Base = expected;
+
+	// Frames held by the receiver past a missing one
+	for (uint8_t i = 0; i < 16; i++)
+	{
+		uint8_t sequence = expected + 1 + i;
+		if ((received & (1 << i)) && (uint8_t)(sequence - Base) < (uint8_t)(Next - Base))
+			Frames[sequence % LINK_WINDOW].state = FRAME_ACKED;
+	}
+
+	// Frames that should have been acknowledged by now are sent again
+	for (uint8_t sequence = Base; sequence != Next; sequence++)
+	{
+		LinkFrame* frame = &Frames[sequence % LINK_WINDOW];
+		if (frame->state == FRAME_SENT && ++frame->waited >= LINK_PATIENCE)
+		{
+			frame->state = FRAME_QUEUED;
+			resend = 1;
+		}
+	}
+
+	if (resend && Streaming)
+		RadioStreamRefill();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Receiving
+//////////////////////////////////////////////////////////////////////////
+
+// Registers function called with every frame received, in order
+void RegisterLinkCallback(void (*callback)(uint8_t*, uint8_t, uint8_t))
+{
+	LinkCallback = callback;
+}
+
+static void LinkDeliver(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	if (LinkCallback)
+		LinkCallback(data, length, pipe);
+}
+
+// Takes a data frame, delivers it and whatever it unblocks
+static void LinkDataReceived(LinkReceiver* receiver, uint8_t sequence, uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	uint8_t distance = sequence - receiver->expected;
+
+	if (distance == 0)
+	{
+		LinkDeliver(data, length, pipe);
+		receiver->expected++;
+
+		// Bit 0 is the expected frame now
+		while (receiver->received & 1)
+		{
+			uint8_t index = receiver->expected % LINK_WINDOW;
+			LinkDeliver(receiver->data[index], receiver->length[index], pipe);
+			receiver->expected++;
+			receiver->received >>= 1;
+		}
+		receiver->received >>= 1;
+	}
+	else if (distance < LINK_WINDOW && !(receiver->received & (1 << (distance - 1))))
+	{
+		// Ahead of a missing frame, keep it
+		uint8_t index = sequence % LINK_WINDOW;
+		receiver->length[index] = length;
+		memcpy(receiver->data[index], data, length);
+		receiver->received |= (1 << (distance - 1));
+	}
+
+	// Anything else is a duplicate
+}
+
+// Sender has given up on frames this side never got (see LINK_MAX_POLLS), skip to its oldest one
+static void LinkPollReceived(LinkReceiver* receiver, uint8_t base)
+{
+	uint8_t skipped = base - receiver->expected;
+
+	// Older poll that was waiting in RX FIFO otherwise
+	if (skipped == 0 || skipped >= 0x80)
+		return;
+
+	receiver->expected = base;
+	receiver->received = 0;
+}
+
+// Puts the pipe's state into its next ACK
+static void LinkAcknowledge(LinkReceiver* receiver, uint8_t pipe)
+{
+	uint8_t ack[LINK_ACK_SIZE];
+
+	ack[0] = LINK_ACK;
+	ack[1] = receiver->expected;
+	ack[2] = receiver->received & 0xFF;
+	ack[3] = receiver->received >> 8;
+
+	RadioUpdateAckPayload(pipe, ack, LINK_ACK_SIZE);
+}
+
+// Handles a received payload, registered by LinkInitialize() as the radio callback
+void LinkPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	if (length < LINK_HEADER_SIZE)
+		return;
+
+	// Sender side
+	if (data[0] == LINK_ACK && length == LINK_ACK_SIZE)
+	{
+		LinkAcknowledged(data[1], data[2] | (data[3] << 8));
+		return;
+	}
+
+	// Receiver side
+	if (pipe >= LINK_PIPES)
+		return;
+
+	LinkReceiver* receiver = &Receivers[pipe];
+
+	if (data[0] == LINK_DATA)
+		LinkDataReceived(receiver, data[1], &data[LINK_HEADER_SIZE], length - LINK_HEADER_SIZE, pipe);
+	else if (data[0] == LINK_POLL)
+		LinkPollReceived(receiver, data[1]);
+	else
+		return;
+
+	LinkAcknowledge(receiver, pipe);
+}
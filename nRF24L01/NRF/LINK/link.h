@@ -0,0 +1,77 @@
+// Reliable, ordered transport on top of the radio, for when losing a packet to MAX_RT is not an option.
+// Frames get sequence numbers and up to LINK_WINDOW of them are in flight at once (streamed, see
+// RadioStreamBegin()). The receiver returns its state in ACK payloads: next sequence number it expects
+// and a bitmap of the frames it holds beyond that, so only what's missing is sent again. Duplicates are
+// dropped and frames are delivered in order.
+// The sender talks to a single peer (TX address), the receiver keeps separate state for each pipe.
+// Both sides need ACK payloads and dynamic payload width, see LinkInitialize().
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// Frames in flight, 1, 2, 4, 8 or 16 (RAM used: 32 bytes per frame on the sender, 31 per frame and pipe on the receiver)
+#ifndef LINK_WINDOW
+#define LINK_WINDOW 8
+#endif
+
+// Data pipes 0..LINK_PIPES-1 accept frames
+#ifndef LINK_PIPES
+#define LINK_PIPES 1
+#endif
+
+// Acknowledgments received after a frame has been sent, without it being acknowledged, before it's sent again
+// Should cover TX FIFO depth (3) plus the one ACK payload the receiver is behind
+#ifndef LINK_PATIENCE
+#define LINK_PATIENCE 6
+#endif
+
+// Polls in a row without any answer before the peer is considered gone and the window is dropped
+#ifndef LINK_MAX_POLLS
+#define LINK_MAX_POLLS 32
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Frames
+//////////////////////////////////////////////////////////////////////////
+
+// Byte 0 - kind, byte 1 - sequence number (DATA), oldest one not acknowledged (POLL), next expected one (ACK)
+#define LINK_HEADER_SIZE 2
+#define LINK_DATA_SIZE (MAXIMUM_PAYLOAD_SIZE - LINK_HEADER_SIZE)
+
+#define LINK_DATA	0xD1
+#define LINK_POLL	0xD2	// No data, asks for an ACK payload
+#define LINK_ACK	0xD3	// Followed by 16-bit bitmap of frames received past the expected one (LSB first)
+
+#define LINK_ACK_SIZE 4
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+void LinkInitialize(void);
+uint8_t LinkSend(const uint8_t* data, uint8_t length);
+uint8_t LinkPending(void);
+uint16_t LinkFailures(void);
+void LinkPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe);
+void RegisterLinkCallback(void (*callback)(uint8_t*, uint8_t, uint8_t));
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+// Slots are picked by sequence % LINK_WINDOW, it has to divide the 8-bit sequence range
+#if (LINK_WINDOW < 1 || LINK_WINDOW > 16 || (LINK_WINDOW & (LINK_WINDOW - 1)) != 0)
+#error "LINK_WINDOW must be 1, 2, 4, 8 or 16!"
+#endif
+
+#if (LINK_PIPES < 1 || LINK_PIPES > 6)
+#error "LINK_PIPES must be between 1 and 6!"
+#endif
+
+#endif /* LINK_H_ */
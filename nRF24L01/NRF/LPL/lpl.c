@@ -0,0 +1,269 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "lpl.h"
+
+#ifdef LPL_TIMER1_SLEEP
+#include <avr/sleep.h>
+#endif
+
+// Period has to fit in half of RADIO_TICKS() range
+#if (LPL_PERIOD_MS * 1000000ULL / RADIO_TICK_NS > 32767)
+#error "LPL_PERIOD_MS is too long for RADIO_TICKS(), use a bigger prescaler!"
+#endif
+
+// Listener phases
+#define LPL_OFF		0
+#define LPL_WAKING	1	// Radio powering up, the window opens once it listens
+#define LPL_LISTEN	2
+#define LPL_SLEEP	3
+
+static uint8_t Phase = LPL_OFF;
+
+// RADIO_TICKS() when the current period started, the phase started and when the window closes
+static uint16_t PeriodStart;
+static uint16_t PhaseStart;
+static uint16_t WindowEnd;
+
+// Message repeated by LplSend() and when it gives up
+static uint8_t SendBuffer[MAXIMUM_PAYLOAD_SIZE];
+static uint8_t SendLength;
+static uint8_t Sending = 0;
+static uint16_t SendStart;
+
+static LplReport Report;
+
+// Called with every packet received in a window
+static void (*LplCallback)(uint8_t*, uint8_t, uint8_t);
+
+#ifdef LPL_TIMER1_SLEEP
+// Nothing to do, it only wakes the MCU up
+ISR(TIMER1_COMPA_vect)
+{
+}
+
+// Idle sleep until Timer1 gets to deadline
+static void LplSleepUntil(uint16_t deadline)
+{
+	cli();
+
+	// Too close, compare match could be missed and the MCU would sleep for the whole timer period
+	if ((int16_t)(deadline - RADIO_TICKS()) < 2)
+	{
+		sei();
+		return;
+	}
+
+	OCR1A = deadline;
+	TIFR1 = (1<<OCF1A);
+	TIMSK1 |= (1<<OCIE1A);
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	TIMSK1 &= ~(1<<OCIE1A);
+}
+#endif
+
+// Time since start, in us
+static uint32_t LplElapsed(uint16_t start)
+{
+	return RADIO_TICKS_TO_US((uint16_t)(RADIO_TICKS() - start));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Listening
+//////////////////////////////////////////////////////////////////////////
+
+// Registers function called with every packet received in a window
+void RegisterLplCallback(void (*callback)(uint8_t*, uint8_t, uint8_t))
+{
+	LplCallback = callback;
+}
+
+// Powers the radio up for the next window
+static void LplWake(void)
+{
+	PhaseStart = RADIO_TICKS();
+	Phase = LPL_WAKING;
+	RadioEnterRxMode();
+}
+
+// Starts duty-cycled listening, the first window opens right away
+// Takes over the radio callback, packets go to RegisterLplCallback()
+void LplStart(void)
+{
+	// Everything is timed with RADIO_TICKS(), make sure its timer runs
+	RADIO_TIMER_START();
+	RegisterRadioCallback(LplPacketReceived);
+
+	PeriodStart = RADIO_TICKS();
+	LplWake();
+}
+
+// Stops duty-cycled listening, the radio stays where it is
+void LplStop(void)
+{
+	Phase = LPL_OFF;
+}
+
+// Handles a received payload, registered by LplStart() as the radio callback
+void LplPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	Report.delivered++;
+
+	// More may be coming, keep listening
+	if (Phase == LPL_LISTEN)
+		WindowEnd = RADIO_TICKS() + RADIO_US_TO_TICKS(LPL_WINDOW_US);
+
+	if (LplCallback)
+		LplCallback(data, length, pipe);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Sending
+//////////////////////////////////////////////////////////////////////////
+
+// Keeps sending the message (up to 32 bytes) until a listener wakes up and acknowledges it,
+// or for a period and a window. Progress is made in LPL_EVENT()
+// Returns QUEUE_OK, or QUEUE_FULL if the previous message is still being sent or the device is busy
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t LplSend(const uint8_t* data, uint8_t length)
+{
+	if (Sending)
+		return QUEUE_FULL;
+
+	if (length > MAXIMUM_PAYLOAD_SIZE)
+		length = MAXIMUM_PAYLOAD_SIZE;
+
+	memcpy(SendBuffer, data, length);
+	SendLength = length;
+	SendStart = RADIO_TICKS();
+
+	if (!RadioSendBuffer(SendBuffer, SendLength))
+		return QUEUE_FULL;
+
+	Sending = 1;
+	return QUEUE_OK;
+}
+
+// Returns 1 until the message is acknowledged or given up on
+uint8_t LplIsSending(void)
+{
+	return Sending;
+}
+
+// Sends the message again after every MAX_RT
+static void LplSendEvent(void)
+{
+	uint8_t result = RadioSendResult();
+
+	if (result == SEND_PENDING)
+		return;
+
+	if (result == SEND_FAILED &&
+		LplElapsed(SendStart) < LPL_PERIOD_MS * 1000UL + LPL_WINDOW_US)
+	{
+		// Refused it comes back as SEND_FAILED too
+		RadioSendBuffer(SendBuffer, SendLength);
+		return;
+	}
+
+	if (result == SEND_DONE)
+		Report.delivered++;
+	else
+		Report.failed++;
+
+	Report.sendUs += LplElapsed(SendStart);
+	Sending = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Scheduler
+//////////////////////////////////////////////////////////////////////////
+
+// Opens and closes the windows, repeats messages being sent
+// Should be called after RADIO_EVENT() in program's main loop, it may put the MCU to sleep
+void LPL_EVENT(void)
+{
+	if (Sending)
+		LplSendEvent();
+
+	uint16_t now = RADIO_TICKS();
+
+	switch (Phase)
+	{
+	case LPL_WAKING:
+		// RADIO_NONBLOCKING - RADIO_EVENT() has to finish the power up
+		if (!RadioIsReady())
+			break;
+
+		Report.powerUpUs += LplElapsed(PhaseStart);
+		Report.windows++;
+		PhaseStart = now;
+		WindowEnd = now + RADIO_US_TO_TICKS(LPL_WINDOW_US);
+		Phase = LPL_LISTEN;
+		break;
+
+	case LPL_LISTEN:
+		if ((int16_t)(now - WindowEnd) < 0)
+			break;
+
+		Report.listenUs += LplElapsed(PhaseStart);
+		RadioPowerDown();
+		PhaseStart = now;
+		Phase = LPL_SLEEP;
+		break;
+
+	case LPL_SLEEP:
+	{
+		uint16_t wake = PeriodStart + RADIO_US_TO_TICKS(LPL_PERIOD_MS * 1000UL);
+
+		if ((int16_t)(now - wake) < 0)
+		{
+			LPL_SLEEP_UNTIL(wake);
+			break;
+		}
+
+		Report.sleepUs += LplElapsed(PhaseStart);
+
+		// Keep the windows in step, unless the main loop has been away for longer than a period
+		PeriodStart = (int16_t)(now - wake) < (int16_t)RADIO_US_TO_TICKS(LPL_WINDOW_US) ? wake : now;
+		LplWake();
+		break;
+	}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Energy report
+//////////////////////////////////////////////////////////////////////////
+
+// Fills the report, energy is estimated from time in each state and LPL_XX_UA currents
+void LplGetReport(LplReport* report)
+{
+	*report = Report;
+
+	// uA * us = pC, times mV gives fJ
+	uint64_t charge = (uint64_t)Report.listenUs * LPL_RX_UA +
+					  (uint64_t)Report.powerUpUs * LPL_STANDBY_UA +
+					  (uint64_t)Report.sleepUs * LPL_POWER_DOWN_UA +
+					  (uint64_t)Report.sendUs * LPL_TX_UA;
+
+	report->energyUj = charge * LPL_SUPPLY_MV / 1000000000ULL;
+	report->energyPerMessageUj = report->delivered ? report->energyUj / report->delivered : 0;
+}
+
+// Starts collecting the report over
+void LplResetReport(void)
+{
+	memset(&Report, 0, sizeof(Report));
+}
@@ -0,0 +1,105 @@
+// Low power listening for battery powered receivers.
+// The listener powers the radio up every LPL_PERIOD_MS for an LPL_WINDOW_US long RX window and keeps it
+// powered down (and the MCU asleep, see LPL_SLEEP_UNTIL) for the rest of the period. A packet received
+// in the window keeps it open for another LPL_WINDOW_US, in case more is coming.
+// The sender can't know when the window opens, so LplSend() keeps sending the message (ACKed, with
+// retransmissions) for a whole period plus a window until it's acknowledged - one of the attempts
+// lands in a window. Make sure LPL_WINDOW_US covers ARD plus a packet, so no window falls between attempts.
+// A lost ACK can get the message delivered twice, use LINK on top if that matters.
+// Time spent in each radio state is kept to estimate energy used per delivered message, see LplGetReport().
+
+#ifndef LPL_H_
+#define LPL_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// Time between RX windows
+#ifndef LPL_PERIOD_MS
+#define LPL_PERIOD_MS 100
+#endif
+
+// RX window, counted from the moment the device is listening (default covers ARD_US_4000)
+#ifndef LPL_WINDOW_US
+#define LPL_WINDOW_US 5000
+#endif
+
+// Radio supply current in each state (uA, data sheet values for 2Mbps, 0dBm) and supply voltage (mV)
+#ifndef LPL_RX_UA
+#define LPL_RX_UA 13500
+#endif
+
+#ifndef LPL_TX_UA
+#define LPL_TX_UA 11300
+#endif
+
+#ifndef LPL_STANDBY_UA
+#define LPL_STANDBY_UA 26
+#endif
+
+#ifndef LPL_POWER_DOWN_UA
+#define LPL_POWER_DOWN_UA 1
+#endif
+
+#ifndef LPL_SUPPLY_MV
+#define LPL_SUPPLY_MV 3000
+#endif
+
+// Sleeps the MCU until RADIO_TICKS() gets to deadline, any interrupt may end it earlier
+// Defaults to Idle sleep woken up by Timer1 compare match A (goes with the default RADIO_TICKS()):
+// LPL takes over Timer1 - TCCR1B (set by RadioInitialize()/LplStart()), OCR1A, OCIE1A in TIMSK1 and
+// TIMER1_COMPA_vect, the application can't use them.
+// Define to the application's own sleep, or empty to keep the main loop running
+#ifndef LPL_SLEEP_UNTIL
+#if defined(SIM_SPI) && SIM_SPI != 0
+#define LPL_SLEEP_UNTIL(deadline)
+#else
+#define LPL_SLEEP_UNTIL(deadline) LplSleepUntil(deadline)
+#define LPL_TIMER1_SLEEP
+#endif
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Types
+//////////////////////////////////////////////////////////////////////////
+
+// Collected since LplResetReport(), times in us (read it at least once an hour, they overflow after 71 minutes)
+typedef struct
+{
+	uint32_t listenUs;			// Radio in RX mode
+	uint32_t powerUpUs;			// Radio powering up and settling before the windows
+	uint32_t sleepUs;			// Radio powered down between the windows
+	uint32_t sendUs;			// Radio sending wake up bursts
+	uint16_t windows;			// RX windows opened
+	uint16_t delivered;			// Messages received (listener), or acknowledged (sender)
+	uint16_t failed;			// Messages nobody acknowledged within a period (sender)
+	uint32_t energyUj;			// Radio energy used
+	uint32_t energyPerMessageUj;	// energyUj / delivered
+} LplReport;
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+void LplStart(void);
+void LplStop(void);
+uint8_t LplSend(const uint8_t* data, uint8_t length);
+uint8_t LplIsSending(void);
+void LPL_EVENT(void);
+void LplPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe);
+void RegisterLplCallback(void (*callback)(uint8_t*, uint8_t, uint8_t));
+void LplGetReport(LplReport* report);
+void LplResetReport(void);
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+#if (LPL_WINDOW_US < 500 || LPL_WINDOW_US > LPL_PERIOD_MS * 1000UL)
+#error "LPL_WINDOW_US must be between 500 and LPL_PERIOD_MS!"
+#endif
+
+#endif /* LPL_H_ */
@@ -0,0 +1,288 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "net.h"
+
+#define NET_DIGIT_MASK 0x07
+
+typedef struct
+{
+	uint16_t nextHop;
+	uint8_t length;
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+} NetFrame;
+
+// Frames waiting to go out, oldest at Head
+static NetFrame Queue[NET_QUEUE_SIZE];
+static uint8_t Head = 0;
+static uint8_t Count = 0;
+
+// This node
+static uint16_t Node;
+
+// Set while the frame at Head is on its way to the next hop, and while the radio is in TX mode
+static uint8_t Sending = 0;
+static uint8_t Transmitting = 0;
+
+static NetStats Stats;
+
+// Called with every frame addressed to this node
+static void (*NetCallback)(uint16_t, uint8_t*, uint8_t);
+
+//////////////////////////////////////////////////////////////////////////
+// Addresses
+//////////////////////////////////////////////////////////////////////////
+
+// Number of digits, 0 for the root
+uint8_t NetDepth(uint16_t node)
+{
+	uint8_t depth = 0;
+
+	while (node)
+	{
+		depth++;
+		node >>= 3;
+	}
+
+	return depth;
+}
+
+// Address of the node's child (1..NET_CHILDREN)
+uint16_t NetChildAddress(uint16_t node, uint8_t child)
+{
+	return node | ((uint16_t)child << (3 * NetDepth(node)));
+}
+
+// Address of the node's parent, the root is its own parent
+uint16_t NetParentAddress(uint16_t node)
+{
+	uint8_t depth = NetDepth(node);
+
+	if (depth == 0)
+		return NET_ROOT;
+
+	return node & ((1U << (3 * (depth - 1))) - 1);
+}
+
+// Full address a node listens on with the pipe, LSB first
+static void NetPipeAddress(uint16_t node, uint8_t pipe, uint8_t* address)
+{
+	address[0] = NET_PIPE_LSB + pipe - 1;
+	address[1] = node & 0xFF;
+	address[2] = node >> 8;
+	memcpy(&address[3], NET_ADDRESS_BASE, 2);
+}
+
+// Where this node sends to reach the neighbour - its parent pipe, or our pipe at the parent
+static void NetHopAddress(uint16_t hop, uint8_t* address)
+{
+	if (NetParentAddress(hop) == Node)
+		NetPipeAddress(hop, DATA_PIPE_1, address);
+	else
+		NetPipeAddress(hop, DATA_PIPE_1 + (Node >> (3 * (NetDepth(Node) - 1))), address);
+}
+
+// Neighbour the frame goes to: the child on the path if the destination is below this node, the parent otherwise
+static uint16_t NetNextHop(uint16_t to)
+{
+	uint8_t depth = NetDepth(Node);
+	uint16_t below = to & ((1U << (3 * depth)) - 1);
+
+	if (below == Node && to != Node)
+		return Node | (to & ((uint16_t)NET_DIGIT_MASK << (3 * depth)));
+
+	return NetParentAddress(Node);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Setup
+//////////////////////////////////////////////////////////////////////////
+
+// Makes the device the node with logical address, listening on its parent and child pipes
+// Takes over the radio callback, frames for this node go to RegisterNetCallback()
+void NetInitialize(uint16_t node)
+{
+	RadioConfigImage image;
+	memcpy_P(&image, &RadioDefaultConfig, sizeof(image));
+
+	Node = node;
+
+	NetPipeAddress(node, DATA_PIPE_1, image.rxAddressP1);
+	for (uint8_t i = 0; i < 4; i++)
+		image.rxAddressLsb[i] = NET_PIPE_LSB + DATA_PIPE_2 + i - 1;
+
+	image.addressWidth = AW_BYTES_5;
+	image.enabledPipes = 0b00111111;
+	image.autoAck = 0b00111111;
+	image.dynamicPayload = 0b00111111;
+	image.feature = (1<<EN_DPL);
+
+	RadioCommitConfig(&image);
+
+	Head = 0;
+	Count = 0;
+	Sending = 0;
+	Transmitting = 0;
+	memset(&Stats, 0, sizeof(Stats));
+
+	RegisterRadioCallback(NetPacketReceived);
+	RadioEnterRxMode();
+}
+
+// Registers function called with every frame addressed to this node
+void RegisterNetCallback(void (*callback)(uint16_t from, uint8_t* data, uint8_t length))
+{
+	NetCallback = callback;
+}
+
+// Copies what's been counted since NetInitialize()
+void NetGetStats(NetStats* stats)
+{
+	*stats = Stats;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Queue
+//////////////////////////////////////////////////////////////////////////
+
+// Puts the whole frame (with header) at the end of the queue
+static uint8_t NetEnqueue(const uint8_t* frame, uint8_t length)
+{
+	if (Count == NET_QUEUE_SIZE)
+		return QUEUE_FULL;
+
+	NetFrame* entry = &Queue[(Head + Count) % NET_QUEUE_SIZE];
+	entry->nextHop = NetNextHop(frame[0] | (frame[1] << 8));
+	entry->length = length;
+	memcpy(entry->data, frame, length);
+	Count++;
+
+	return QUEUE_OK;
+}
+
+// Queues the frame (up to 27 bytes) for the node, it's sent from NET_EVENT()
+// Returns QUEUE_OK, or QUEUE_FULL if there's no room in the queue
+uint8_t NetSend(uint16_t to, const uint8_t* data, uint8_t length)
+{
+	uint8_t frame[MAXIMUM_PAYLOAD_SIZE];
+
+	if (length > NET_DATA_SIZE)
+		length = NET_DATA_SIZE;
+
+	frame[0] = to & 0xFF;
+	frame[1] = to >> 8;
+	frame[2] = Node & 0xFF;
+	frame[3] = Node >> 8;
+	frame[4] = 0;
+	memcpy(&frame[NET_HEADER_SIZE], data, length);
+
+	return NetEnqueue(frame, NET_HEADER_SIZE + length);
+}
+
+// Frames waiting to be sent or relayed, including the one on its way
+uint8_t NetPending(void)
+{
+	return Count;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Receiving
+//////////////////////////////////////////////////////////////////////////
+
+// Handles a received payload, registered by NetInitialize() as the radio callback
+// Frames for other nodes are queued for NET_EVENT(), without bothering the application
+void NetPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe)
+{
+	(void)pipe;
+
+	if (length < NET_HEADER_SIZE)
+		return;
+
+	uint16_t to = data[0] | (data[1] << 8);
+
+	if (to == Node)
+	{
+		Stats.delivered++;
+		if (NetCallback)
+			NetCallback(data[2] | (data[3] << 8), &data[NET_HEADER_SIZE], length - NET_HEADER_SIZE);
+		return;
+	}
+
+	if (data[4] >= NET_MAX_HOPS)
+	{
+		Stats.expired++;
+		return;
+	}
+
+	data[4]++;
+	if (NetEnqueue(data, length) == QUEUE_FULL)
+		Stats.dropped++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Scheduler
+//////////////////////////////////////////////////////////////////////////
+
+// Counts the frame at Head once the radio is done with it and takes it off the queue
+static void NetSent(void)
+{
+	uint8_t result = RadioSendResult();
+	NetFrame* frame = &Queue[Head];
+
+	if (result == SEND_PENDING)
+		return;
+
+	if (result == SEND_FAILED)
+		Stats.failed++;
+	else if ((frame->data[2] | (frame->data[3] << 8)) == Node)
+		Stats.sent++;
+	else
+		Stats.forwarded++;
+
+	Head = (Head + 1) % NET_QUEUE_SIZE;
+	Count--;
+	Sending = 0;
+}
+
+// Sends queued frames one by one and listens when there's nothing left
+// Should be called after RADIO_EVENT() in program's main loop
+void NET_EVENT(void)
+{
+	if (Sending)
+		NetSent();
+
+	// RADIO_NONBLOCKING - RADIO_EVENT() has to finish the last mode change
+	if (Sending || !RadioIsReady())
+		return;
+
+	if (Count == 0)
+	{
+		if (Transmitting)
+		{
+			Transmitting = 0;
+			RadioEnterRxMode();
+		}
+		return;
+	}
+
+	if (!Transmitting)
+	{
+		Transmitting = 1;
+		RadioEnterTxMode();
+	}
+
+	// ACK comes back on pipe 0
+	uint8_t address[5];
+	NetFrame* frame = &Queue[Head];
+	NetHopAddress(frame->nextHop, address);
+	RadioUpdateAddress(TX_ADDR, address);
+	RadioUpdateAddress(RX_ADDR_P0, address);
+
+	// Tried again from the next call if the device isn't ready for it
+	Sending = RadioSendBuffer(frame->data, frame->length);
+}
@@ -0,0 +1,100 @@
+// Multi-hop tree network, for when single hop range isn't enough.
+// Every node has a logical 16-bit address telling where it sits in the tree: 0 is the root and each
+// level adds a digit (1..4, 3 bits, lowest digit first), so 0x0009 (octal 011) is child 1 of child 1 of
+// the root. A frame goes down to the child on the path when the destination is below the node, up to the
+// parent otherwise, so no routing tables are needed.
+// A node listens for its parent on pipe 1 and for its children on pipes 2..5, pipe 0 takes the ACKs of
+// whatever it sends. Frames waiting to go out (own and relayed) are kept in a bounded queue, a full queue
+// drops relayed frames, and frames that have made NET_MAX_HOPS hops are dropped too.
+// Relaying is done in NET_EVENT(), the application's callback only gets the frames addressed to its node.
+// The node listens whenever it has nothing to send, packets arriving while it sends are left to the
+// sender's retransmissions (make ARD cover a frame sent by this node).
+
+#ifndef NET_H_
+#define NET_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// Frames waiting to be sent or relayed (RAM used: 35 bytes per frame)
+#ifndef NET_QUEUE_SIZE
+#define NET_QUEUE_SIZE 4
+#endif
+
+// Hops a frame can make before it's dropped
+#ifndef NET_MAX_HOPS
+#define NET_MAX_HOPS 8
+#endif
+
+// Address bytes shared by all nodes, 2 characters
+#ifndef NET_ADDRESS_BASE
+#define NET_ADDRESS_BASE "NT"
+#endif
+
+// Address LSB of pipe 1 (parent), child n is on pipe n + 1 with NET_PIPE_LSB + n
+#ifndef NET_PIPE_LSB
+#define NET_PIPE_LSB 0xB1
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Addresses and frames
+//////////////////////////////////////////////////////////////////////////
+
+#define NET_ROOT		0
+#define NET_CHILDREN	4	// Per node, one per pipe 2..5
+#define NET_LEVELS		5	// Digits in an address
+
+// Bytes 0-1 - destination, bytes 2-3 - source (LSB first), byte 4 - hops made so far
+#define NET_HEADER_SIZE 5
+#define NET_DATA_SIZE (MAXIMUM_PAYLOAD_SIZE - NET_HEADER_SIZE)
+
+//////////////////////////////////////////////////////////////////////////
+// Types
+//////////////////////////////////////////////////////////////////////////
+
+// Counted since NetInitialize()
+typedef struct
+{
+	uint16_t sent;			// Own frames taken by the next hop
+	uint16_t forwarded;		// Frames relayed for other nodes
+	uint16_t delivered;		// Frames for this node
+	uint16_t failed;		// Frames the next hop didn't acknowledge (MAX_RT)
+	uint16_t dropped;		// Relayed frames that didn't fit in the queue
+	uint16_t expired;		// Frames that have made NET_MAX_HOPS hops
+} NetStats;
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+void NetInitialize(uint16_t node);
+uint16_t NetChildAddress(uint16_t node, uint8_t child);
+uint16_t NetParentAddress(uint16_t node);
+uint8_t NetDepth(uint16_t node);
+uint8_t NetSend(uint16_t to, const uint8_t* data, uint8_t length);
+uint8_t NetPending(void);
+void NET_EVENT(void);
+void NetPacketReceived(uint8_t* data, uint8_t length, uint8_t pipe);
+void RegisterNetCallback(void (*callback)(uint16_t from, uint8_t* data, uint8_t length));
+void NetGetStats(NetStats* stats);
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+#if (NET_QUEUE_SIZE < 1 || NET_QUEUE_SIZE > 255)
+#error "NET_QUEUE_SIZE must be between 1 and 255!"
+#endif
+
+#if (NET_MAX_HOPS < 1 || NET_MAX_HOPS > 255)
+#error "NET_MAX_HOPS must be between 1 and 255!"
+#endif
+
+#if (NET_PIPE_LSB > 0xFB)
+#error "NET_PIPE_LSB must leave room for five pipes!"
+#endif
+
+#endif /* NET_H_ */
@@ -0,0 +1,83 @@
+#include "../../Common/Common.h"
+#include <avr/io.h>
+#include <util/delay.h>
+#include <string.h>
+
+#include "../SPI/spi.h"
+#include "../nrf24.h"
+#include "scan.h"
+
+// Adds RPD samples of every channel to the histogram, SCAN_SAMPLES per channel and sweep (up to SCAN_MAX_SWEEPS)
+// The channel is restored afterwards
+// NOTE: Make sure the device is in RX mode (and RadioIsReady()) before calling this method
+void ScanChannels(uint8_t* histogram, uint8_t sweeps)
+{
+	uint8_t channel = RadioReadShadow(RF_CH);
+
+	if (sweeps > SCAN_MAX_SWEEPS)
+		sweeps = SCAN_MAX_SWEEPS;
+
+	memset(histogram, 0, SCAN_CHANNELS);
+
+	for (uint8_t sweep = 0; sweep < sweeps; sweep++)
+	{
+		for (uint8_t i = 0; i < SCAN_CHANNELS; i++)
+		{
+			// Listening starts over on the new channel
+			CE_LOW;
+			RadioUpdateRegister(RF_CH, i);
+			CE_HIGH;
+			_delay_us(SCAN_SETTLE_US);
+
+			for (uint8_t sample = 0; sample < SCAN_SAMPLES; sample++)
+			{
+				if (RadioReadRegisterSingle(RPD) & 0x01)
+					histogram[i]++;
+				_delay_us(SCAN_SAMPLE_US);
+			}
+		}
+	}
+
+	CE_LOW;
+	RadioUpdateRegister(RF_CH, channel);
+	CE_HIGH;
+}
+
+// Returns the channel (0..SCAN_HIGHEST_CHANNEL) with the least activity on and around it
+// Ties go to the lowest channel
+uint8_t ScanBestChannel(const uint8_t* histogram)
+{
+	uint8_t best = 0;
+	uint16_t bestScore = 0xFFFF;
+
+	for (uint8_t i = 0; i <= SCAN_HIGHEST_CHANNEL; i++)
+	{
+		uint16_t score = 2 * histogram[i];
+		if (i > 0)
+			score += histogram[i - 1];
+		if (i < SCAN_CHANNELS - 1)
+			score += histogram[i + 1];
+
+		if (score < bestScore)
+		{
+			best = i;
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
+
+// Surveys the band and switches to the quietest channel, returns it
+// NOTE: Make sure the device is in RX mode (and RadioIsReady()) before calling this method
+uint8_t ScanSelectChannel(uint8_t sweeps)
+{
+	uint8_t histogram[SCAN_CHANNELS];
+
+	ScanChannels(histogram, sweeps);
+
+	uint8_t channel = ScanBestChannel(histogram);
+	RadioSetChannel(channel);
+
+	return channel;
+}
@@ -0,0 +1,68 @@
+// Spectrum survey with the received power detector (RPD), to keep away from WiFi and other 2.4 GHz traffic.
+// ScanChannels() sweeps RF_CH 0..125 in RX mode and samples RPD SCAN_SAMPLES times on each channel, the
+// histogram counts the samples that found something stronger than -64 dBm. ScanBestChannel() picks the
+// quietest channel, counting half of both neighbours (a 2 Mbps signal is 2 MHz wide), and ScanSelectChannel()
+// does both and switches to it - meant for start up, both ends have to agree on the channel afterwards.
+// A sweep takes about 126 * (SCAN_SETTLE_US + SCAN_SAMPLES * SCAN_SAMPLE_US) us, the radio doesn't receive
+// anything on its own channel meanwhile.
+
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// RPD samples per channel and sweep
+#ifndef SCAN_SAMPLES
+#define SCAN_SAMPLES 16
+#endif
+
+// Time between samples, RPD looks at the last 40us
+#ifndef SCAN_SAMPLE_US
+#define SCAN_SAMPLE_US 40
+#endif
+
+// Time in RX mode on a new channel before RPD shows it (130us PLL settling + 40us, see data sheet)
+#ifndef SCAN_SETTLE_US
+#define SCAN_SETTLE_US 170
+#endif
+
+// Highest channel ScanBestChannel() picks, 2483 MHz is where the 2.4 GHz ISM band ends in most countries
+#ifndef SCAN_HIGHEST_CHANNEL
+#define SCAN_HIGHEST_CHANNEL 83
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Histogram
+//////////////////////////////////////////////////////////////////////////
+
+// RF_CH 0..125, 2400..2525 MHz
+#define SCAN_CHANNELS 126
+
+// Sweeps one histogram can count (one byte per channel)
+#define SCAN_MAX_SWEEPS (255 / SCAN_SAMPLES)
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+void ScanChannels(uint8_t* histogram, uint8_t sweeps);
+uint8_t ScanBestChannel(const uint8_t* histogram);
+uint8_t ScanSelectChannel(uint8_t sweeps);
+
+//////////////////////////////////////////////////////////////////////////
+// Compile time error checks
+//////////////////////////////////////////////////////////////////////////
+#if (SCAN_SAMPLES < 1 || SCAN_SAMPLES > 255)
+#error "SCAN_SAMPLES must be between 1 and 255!"
+#endif
+
+#if (SCAN_HIGHEST_CHANNEL >= SCAN_CHANNELS)
+#error "SCAN_HIGHEST_CHANNEL must be below 126!"
+#endif
+
+#endif /* SCAN_H_ */
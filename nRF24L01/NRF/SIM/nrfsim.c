@@ -0,0 +1,972 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "nrfsim.h"
+
+// Flags in STATUS (and their mask bits in CONFIG)
+#define IRQ_FLAGS ((1<<RX_DR) | (1<<TX_DS) | (1<<MAX_RT))
+
+// All the chips on the simulated medium
+static NrfSimDevice Devices[NRF_SIM_MAX_DEVICES];
+static uint8_t DeviceCount = 0;
+
+// Chip the SPI bus, CE and CSN are currently connected to
+static NrfSimDevice* Selected = 0;
+
+// Simulated time in nanoseconds
+static uint64_t Now = 0;
+
+// Time needed to shift one byte over SPI
+static uint64_t SpiByteNs = 8000;
+
+// Packet and ACK loss probability in 1/1000
+static uint16_t FrameLoss = 0;
+static uint16_t AckLoss = 0;
+static uint32_t Seed = 0x2545F491;
+
+// Share of time (1/1000) something else transmits on each RF_CH, it shows in RPD and takes packets with it
+static uint16_t Noise[128];
+
+// Attenuation between the chips in dB, 0 - close enough for anything to get through
+static uint8_t PathLoss = 0;
+
+// Scripted node taking part in the traffic, optional
+static uint8_t (*Peer)(const NrfSimFrame* frame, NrfSimPayload* ackPayload);
+
+//////////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////////
+
+// xorshift, good enough to decide which packets get lost
+static uint8_t Chance(uint16_t permille)
+{
+	if (permille == 0)
+		return 0;
+
+	Seed ^= Seed << 13;
+	Seed ^= Seed >> 17;
+	Seed ^= Seed << 5;
+	return (Seed % 1000) < permille;
+}
+
+static uint8_t AddressLength(NrfSimDevice* device)
+{
+	uint8_t aw = device->registers[SETUP_AW] & 0x03;
+	return aw == 0 ? 3 : aw + 2;
+}
+
+static uint8_t CrcLength(NrfSimDevice* device)
+{
+	uint8_t config = device->registers[CONFIG];
+
+	// Auto ACK forces CRC on
+	if (!(config & (1<<EN_CRC)) && device->registers[EN_AA] == 0)
+		return 0;
+
+	return (config & (1<<CRCO)) ? 2 : 1;
+}
+
+static uint8_t Rate(NrfSimDevice* device)
+{
+	return device->registers[RF_SETUP] & ((1<<RF_DR_LOW) | (1<<RF_DR_HIGH));
+}
+
+static uint16_t PayloadCrc(const uint8_t* data, uint8_t length)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return crc;
+}
+
+static uint8_t Status(NrfSimDevice* device)
+{
+	uint8_t status = device->registers[STATUS] & IRQ_FLAGS;
+
+	// RX_P_NO is 111 when RX FIFO is empty
+	if (device->rxCount)
+		status |= device->rxFifo[0].pipe << RX_P_NO;
+	else
+		status |= 0x07 << RX_P_NO;
+
+	if (device->txCount == NRF_SIM_FIFO_DEPTH)
+		status |= (1<<TX_FULL);
+
+	return status;
+}
+
+static uint8_t FifoStatus(NrfSimDevice* device)
+{
+	uint8_t fifoStatus = 0;
+
+	if (device->txReuse)
+		fifoStatus |= (1<<TX_REUSE);
+	if (device->txCount == NRF_SIM_FIFO_DEPTH)
+		fifoStatus |= (1<<FIFO_FULL);
+	if (device->txCount == 0)
+		fifoStatus |= (1<<TX_EMPTY);
+	if (device->rxCount == NRF_SIM_FIFO_DEPTH)
+		fifoStatus |= (1<<RX_FULL);
+	if (device->rxCount == 0)
+		fifoStatus |= (1<<RX_EMPTY);
+
+	return fifoStatus;
+}
+
+// Drives the IRQ pin, active low while any unmasked flag is set
+static void UpdateIrq(NrfSimDevice* device)
+{
+	uint8_t pending = device->registers[STATUS] & ~device->registers[CONFIG] & IRQ_FLAGS;
+	uint8_t level = pending ? 0 : 1;
+
+	if (level == device->irq)
+		return;
+
+	device->irq = level;
+
+	if (level == 0)
+		device->stats.irqEdges++;
+
+	if (device->irqPin)
+	{
+		if (level)
+			*device->irqPin |= (1 << device->irqBit);
+		else
+			*device->irqPin &= ~(1 << device->irqBit);
+	}
+
+	// Pin change interrupt fires on both edges
+	if (device->isr)
+		device->isr();
+}
+
+static void FifoPop(NrfSimPayload* fifo, uint8_t* count, uint8_t index)
+{
+	for (uint8_t i = index + 1; i < *count; i++)
+		fifo[i - 1] = fifo[i];
+	(*count)--;
+}
+
+static uint8_t PushRx(NrfSimDevice* device, const NrfSimPayload* payload)
+{
+	if (device->rxSink)
+	{
+		device->stats.rxPackets++;
+		return 1;
+	}
+
+	if (device->rxCount == NRF_SIM_FIFO_DEPTH)
+	{
+		device->stats.rxDropped++;
+		return 0;
+	}
+
+	device->rxFifo[device->rxCount++] = *payload;
+	device->registers[STATUS] |= (1<<RX_DR);
+	device->stats.rxPackets++;
+	UpdateIrq(device);
+	return 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Registers
+//////////////////////////////////////////////////////////////////////////
+
+static uint8_t* AddressRegister(NrfSimDevice* device, uint8_t reg)
+{
+	switch (reg)
+	{
+		case RX_ADDR_P0: return device->rxAddressP0;
+		case RX_ADDR_P1: return device->rxAddressP1;
+		case TX_ADDR:	 return device->txAddress;
+		default:		 return 0;
+	}
+}
+
+// Received power detector, a sample of the channel once the receiver has been listening long enough
+static uint8_t ReceivedPower(NrfSimDevice* device)
+{
+	uint8_t* registers = device->registers;
+
+	if (!(registers[CONFIG] & (1<<PWR_UP)) || !(registers[CONFIG] & (1<<PRIM_RX)) || !device->ce)
+		return 0;
+
+	if (Now - device->rxStartNs < NRF_SIM_RPD_NS)
+		return 0;
+
+	return Chance(Noise[registers[RF_CH]]);
+}
+
+static uint8_t ReadRegisterByte(NrfSimDevice* device, uint8_t reg, uint8_t index)
+{
+	uint8_t* address = AddressRegister(device, reg);
+	if (address)
+		return address[index < 5 ? index : 4];
+
+	switch (reg)
+	{
+		case STATUS:	  return Status(device);
+		case FIFO_STATUS: return FifoStatus(device);
+		case RPD:		  return ReceivedPower(device);
+		default:		  return device->registers[reg];
+	}
+}
+
+static void WriteRegisterByte(NrfSimDevice* device, uint8_t reg, uint8_t index, uint8_t value)
+{
+	uint8_t* address = AddressRegister(device, reg);
+	if (address)
+	{
+		if (index < 5)
+			address[index] = value;
+		return;
+	}
+
+	// Single-byte registers take the first data byte only
+	if (index != 0)
+		return;
+
+	switch (reg)
+	{
+		// Flags are cleared by writing one
+		case STATUS:
+			device->registers[STATUS] &= ~(value & IRQ_FLAGS);
+			break;
+
+		// Read-only
+		case OBSERVE_TX:
+		case RPD:
+		case FIFO_STATUS:
+			break;
+
+		// Writing RF_CH resets the lost packets counter
+		case RF_CH:
+			device->registers[RF_CH] = value & 0x7F;
+			device->registers[OBSERVE_TX] &= 0x0F;
+			device->rxStartNs = Now;
+			break;
+
+		default:
+			device->registers[reg] = value;
+			break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Enhanced ShockBurst
+//////////////////////////////////////////////////////////////////////////
+
+// Delivers a frame to one chip, returns 1 if it sends an ACK back
+static uint8_t Receive(NrfSimDevice* device, const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	uint8_t* registers = device->registers;
+
+	// Receiver must be powered up, in PRX and listening
+	if (!(registers[CONFIG] & (1<<PWR_UP)) || !(registers[CONFIG] & (1<<PRIM_RX)) || !device->ce)
+		return 0;
+
+	if (registers[RF_CH] != frame->channel || Rate(device) != frame->rate)
+		return 0;
+
+	uint8_t aw = AddressLength(device);
+	if (aw != frame->addressLength)
+		return 0;
+
+	// Find the data pipe the address belongs to
+	uint8_t pipe;
+	for (pipe = 0; pipe < 6; pipe++)
+	{
+		if (!(registers[EN_RXADDR] & (1 << pipe)))
+			continue;
+
+		if (pipe == DATA_PIPE_0 && memcmp(device->rxAddressP0, frame->address, aw) == 0)
+			break;
+		if (pipe == DATA_PIPE_1 && memcmp(device->rxAddressP1, frame->address, aw) == 0)
+			break;
+		if (pipe > DATA_PIPE_1 && registers[RX_ADDR_P0 + pipe] == frame->address[0] &&
+			memcmp(&device->rxAddressP1[1], &frame->address[1], aw - 1) == 0)
+			break;
+	}
+	if (pipe == 6)
+		return 0;
+
+	// Static payload width must match, otherwise CRC check fails
+	uint8_t dynamic = (registers[FEATURE] & (1<<EN_DPL)) && (registers[DYNPD] & (1 << pipe));
+	if (!dynamic && (registers[RX_PW_P0 + pipe] == 0 || registers[RX_PW_P0 + pipe] != frame->length))
+		return 0;
+
+	uint8_t sendAck = (registers[EN_AA] & (1 << pipe)) && !frame->noAck;
+	uint16_t crc = PayloadCrc(frame->data, frame->length);
+
+	// Retransmission of a packet already received: ACK it, but don't store it again
+	uint8_t duplicate = sendAck && device->lastPid[pipe] == frame->pid && device->lastCrc[pipe] == crc;
+
+	if (!duplicate)
+	{
+		NrfSimPayload payload;
+		payload.length = frame->length;
+		payload.pipe = pipe;
+		payload.noAck = frame->noAck;
+		payload.ackPayload = 0;
+		memcpy(payload.data, frame->data, frame->length);
+
+		// No room - no ACK, the transmitter will try again
+		if (!PushRx(device, &payload))
+			return 0;
+
+		device->lastPid[pipe] = frame->pid;
+		device->lastCrc[pipe] = crc;
+	}
+
+	if (!sendAck)
+		return 0;
+
+	ackPayload->length = 0;
+
+	// Attach payload queued for this pipe
+	if (!duplicate && (registers[FEATURE] & (1<<EN_ACK_PAY)))
+	{
+		for (uint8_t i = 0; i < device->txCount; i++)
+		{
+			if (device->txFifo[i].ackPayload && device->txFifo[i].pipe == pipe)
+			{
+				*ackPayload = device->txFifo[i];
+				FifoPop(device->txFifo, &device->txCount, i);
+				registers[STATUS] |= (1<<TX_DS);
+				UpdateIrq(device);
+				break;
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Share of packets (1/1000) lost on the way, from what's left of the sender's power over the receiver's
+// sensitivity (data sheet: -82 dBm at 2 Mbps, -85 dBm at 1 Mbps, -94 dBm at 250 kbps)
+// Under 6 dB of margin the packets start to go, at 0 dB almost all of them
+static uint16_t LinkLoss(uint8_t rfSetup, uint8_t rate)
+{
+	if (PathLoss == 0)
+		return 0;
+
+	int16_t power = ((rfSetup & POWER_DBM_0) >> RF_PWR_LOW) * 6 - 18;
+	int16_t sensitivity = rate == KBPS_250 ? -94 : rate == MBPS_1 ? -85 : -82;
+	int16_t margin = power - PathLoss - sensitivity;
+
+	if (margin >= 6)
+		return 0;
+	if (margin < 0)
+		return 1000;
+
+	return (6 - margin) * 160;
+}
+
+// Puts a frame on air, returns 1 if anyone acknowledged it
+static uint8_t Broadcast(NrfSimDevice* source, const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	uint8_t acked = 0;
+	NrfSimPayload ack;
+
+	ackPayload->length = 0;
+
+	// Frames injected from outside go at full power, so do the scripted peer's ACKs
+	uint16_t frameLoss = LinkLoss(source ? source->registers[RF_SETUP] : POWER_DBM_0, frame->rate);
+
+	for (uint8_t i = 0; i < DeviceCount; i++)
+	{
+		NrfSimDevice* device = &Devices[i];
+		if (device == source || Chance(FrameLoss) || Chance(Noise[frame->channel]) || Chance(frameLoss))
+			continue;
+
+		if (Receive(device, frame, &ack) && !Chance(AckLoss) && !Chance(LinkLoss(device->registers[RF_SETUP], frame->rate)) && !acked)
+		{
+			acked = 1;
+			*ackPayload = ack;
+		}
+	}
+
+	if (Peer && !Chance(FrameLoss) && !Chance(Noise[frame->channel]) && !Chance(frameLoss))
+	{
+		ack.length = 0;
+		if (Peer(frame, &ack) && !Chance(AckLoss) && !Chance(LinkLoss(POWER_DBM_0, frame->rate)) && !acked)
+		{
+			acked = 1;
+			*ackPayload = ack;
+		}
+	}
+
+	return acked;
+}
+
+// Starts transmitting TX FIFO head if the chip is allowed to
+static void Kick(NrfSimDevice* device)
+{
+	uint8_t config = device->registers[CONFIG];
+
+	if (device->txActive || !device->ce || !device->txCount)
+		return;
+	if (!(config & (1<<PWR_UP)) || (config & (1<<PRIM_RX)))
+		return;
+
+	// Chip halts until MAX_RT is cleared
+	if (device->registers[STATUS] & (1<<MAX_RT))
+		return;
+
+	NrfSimPayload* head = &device->txFifo[0];
+	if (head->ackPayload)
+		return;
+
+	uint64_t airtime = NrfSimAirtimeNs(Rate(device), AddressLength(device), head->length, CrcLength(device));
+
+	device->txActive = 1;
+	device->txWaitingAck = 0;
+	device->txAttempt = 1;
+	if (!device->txReuse)
+		device->txPid = (device->txPid + 1) & 0x03;
+	device->txEventNs = Now + NRF_SIM_SETTLE_NS + airtime;
+
+	device->stats.airtimeNs += airtime;
+	device->stats.txAttempts++;
+}
+
+static void TransmitSucceeded(NrfSimDevice* device)
+{
+	uint8_t* registers = device->registers;
+
+	if (!device->txReuse)
+		FifoPop(device->txFifo, &device->txCount, 0);
+
+	registers[OBSERVE_TX] = (registers[OBSERVE_TX] & 0xF0) | ((device->txAttempt - 1) & 0x0F);
+	registers[STATUS] |= (1<<TX_DS);
+
+	// ACK payloads are always delivered on data pipe 0
+	if (device->txAckPayload.length)
+	{
+		device->txAckPayload.pipe = DATA_PIPE_0;
+		device->txAckPayload.ackPayload = 0;
+		PushRx(device, &device->txAckPayload);
+	}
+
+	device->txActive = 0;
+	device->stats.txPackets++;
+	UpdateIrq(device);
+	Kick(device);
+}
+
+static void TransmitFailed(NrfSimDevice* device)
+{
+	uint8_t* registers = device->registers;
+	uint8_t lost = registers[OBSERVE_TX] >> PLOS_CNT;
+
+	if (lost < 15)
+		lost++;
+
+	registers[OBSERVE_TX] = (lost << PLOS_CNT) | (registers[SETUP_RETR] & 0x0F);
+	registers[STATUS] |= (1<<MAX_RT);
+
+	device->txActive = 0;
+	device->stats.txFailed++;
+	UpdateIrq(device);
+}
+
+// Handles end of a packet or end of waiting for its ACK
+static void ProcessTx(NrfSimDevice* device)
+{
+	uint8_t* registers = device->registers;
+
+	// Payload flushed while on air
+	if (device->txCount == 0)
+	{
+		device->txActive = 0;
+		return;
+	}
+
+	NrfSimPayload* head = &device->txFifo[0];
+
+	if (!device->txWaitingAck)
+	{
+		NrfSimFrame frame;
+		frame.channel = registers[RF_CH];
+		frame.rate = Rate(device);
+		frame.addressLength = AddressLength(device);
+		memcpy(frame.address, device->txAddress, 5);
+		frame.pid = device->txPid;
+		frame.noAck = head->noAck && (registers[FEATURE] & (1<<EN_DYN_ACK));
+		frame.length = head->length;
+		memcpy(frame.data, head->data, head->length);
+
+		device->txAcked = Broadcast(device, &frame, &device->txAckPayload);
+
+		// Nothing to wait for
+		if (frame.noAck || !(registers[EN_AA] & (1<<ENAA_P0)))
+		{
+			device->txAckPayload.length = 0;
+			TransmitSucceeded(device);
+			return;
+		}
+
+		device->txWaitingAck = 1;
+
+		if (device->txAcked)
+		{
+			uint64_t ackAirtime = NrfSimAirtimeNs(frame.rate, frame.addressLength, device->txAckPayload.length, CrcLength(device));
+			device->stats.airtimeNs += ackAirtime;
+			device->txEventNs = Now + NRF_SIM_SETTLE_NS + ackAirtime;
+		}
+		else
+		{
+			// Auto retransmit delay, from the end of one transmission to the start of the next
+			device->txEventNs = Now + (uint64_t)((registers[SETUP_RETR] >> ARD) + 1) * 250000ULL;
+		}
+		return;
+	}
+
+	if (device->txAcked)
+	{
+		TransmitSucceeded(device);
+		return;
+	}
+
+	if (device->txAttempt > (registers[SETUP_RETR] & 0x0F))
+	{
+		TransmitFailed(device);
+		return;
+	}
+
+	// Retransmit
+	uint64_t airtime = NrfSimAirtimeNs(Rate(device), AddressLength(device), head->length, CrcLength(device));
+	device->txAttempt++;
+	device->txWaitingAck = 0;
+	device->txEventNs = Now + airtime;
+	device->stats.airtimeNs += airtime;
+	device->stats.txAttempts++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Chips and medium
+//////////////////////////////////////////////////////////////////////////
+
+static void DeviceReset(NrfSimDevice* device)
+{
+	memset(device, 0, sizeof(NrfSimDevice));
+
+	// Reset values from the data sheet
+	device->registers[CONFIG] = 0x08;
+	device->registers[EN_AA] = 0x3F;
+	device->registers[EN_RXADDR] = 0x03;
+	device->registers[SETUP_AW] = 0x03;
+	device->registers[SETUP_RETR] = 0x03;
+	device->registers[RF_CH] = 0x02;
+	device->registers[RF_SETUP] = 0x0E;
+	device->registers[RX_ADDR_P2] = 0xC3;
+	device->registers[RX_ADDR_P3] = 0xC4;
+	device->registers[RX_ADDR_P4] = 0xC5;
+	device->registers[RX_ADDR_P5] = 0xC6;
+	memset(device->rxAddressP0, 0xE7, 5);
+	memset(device->rxAddressP1, 0xC2, 5);
+	memset(device->txAddress, 0xE7, 5);
+	memset(device->lastPid, 0xFF, 6);
+
+	device->csn = 1;
+	device->irq = 1;
+}
+
+// Removes all the chips and starts the clock over, the first chip gets selected
+void NrfSimReset(void)
+{
+	DeviceCount = 0;
+	Now = 0;
+	FrameLoss = 0;
+	AckLoss = 0;
+	PathLoss = 0;
+	memset(Noise, 0, sizeof(Noise));
+	Peer = 0;
+	SpiByteNs = 8000;
+	Selected = NrfSimAddDevice();
+}
+
+NrfSimDevice* NrfSimAddDevice(void)
+{
+	if (DeviceCount == NRF_SIM_MAX_DEVICES)
+		return 0;
+
+	NrfSimDevice* device = &Devices[DeviceCount++];
+	DeviceReset(device);
+	return device;
+}
+
+// Connects SPI, CE and CSN to the given chip
+void NrfSimSelect(NrfSimDevice* device)
+{
+	Selected = device;
+}
+
+NrfSimDevice* NrfSimSelected(void)
+{
+	if (!Selected)
+		NrfSimReset();
+	return Selected;
+}
+
+// Sets probability (1/1000) of losing a packet and of losing an ACK
+void NrfSimSetLoss(uint16_t framePermille, uint16_t ackPermille)
+{
+	FrameLoss = framePermille;
+	AckLoss = ackPermille;
+}
+
+// Sets share of time (1/1000) the channel is taken by other transmitters, like WiFi
+// RPD reads 1 that often, and packets on the channel get lost that often
+void NrfSimSetNoise(uint8_t channel, uint16_t permille)
+{
+	Noise[channel & 0x7F] = permille;
+}
+
+// Sets attenuation (dB) between the chips, packets get lost when the sender's power (RF_SETUP) doesn't
+// leave enough margin over the sensitivity at the data rate, 0 turns it off
+void NrfSimSetPathLoss(uint8_t dB)
+{
+	PathLoss = dB;
+}
+
+// Registers a scripted node that sees every transmitted frame
+// It returns 1 to acknowledge the frame and may fill in the ACK payload
+void NrfSimSetPeer(uint8_t (*peer)(const NrfSimFrame* frame, NrfSimPayload* ackPayload))
+{
+	Peer = peer;
+}
+
+// Puts a frame on air from outside of the simulated chips, returns 1 if it has been acknowledged
+uint8_t NrfSimInject(const NrfSimFrame* frame, NrfSimPayload* ackPayload)
+{
+	NrfSimPayload ack;
+	uint8_t acked = Broadcast(0, frame, &ack);
+
+	if (ackPayload)
+		*ackPayload = ack;
+
+	return acked;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Clock
+//////////////////////////////////////////////////////////////////////////
+
+uint64_t NrfSimNanos(void)
+{
+	return Now;
+}
+
+uint32_t NrfSimMicros(void)
+{
+	return (uint32_t)(Now / 1000);
+}
+
+// Moves simulated time forward, handling every transmission event on the way
+void NrfSimAdvance(uint64_t ns)
+{
+	uint64_t target = Now + ns;
+
+	while (1)
+	{
+		NrfSimDevice* next = 0;
+
+		for (uint8_t i = 0; i < DeviceCount; i++)
+		{
+			NrfSimDevice* device = &Devices[i];
+			if (device->txActive && device->txEventNs <= target && (!next || device->txEventNs < next->txEventNs))
+				next = device;
+		}
+
+		if (!next)
+			break;
+
+		if (next->txEventNs > Now)
+			Now = next->txEventNs;
+
+		ProcessTx(next);
+	}
+
+	Now = target;
+}
+
+void NrfSimSetSpiClock(uint32_t hz)
+{
+	if (hz)
+		SpiByteNs = 8000000000ULL / hz;
+}
+
+// Time on air of a single packet: preamble, address, packet control field, payload and CRC
+uint64_t NrfSimAirtimeNs(uint8_t rate, uint8_t addressLength, uint8_t length, uint8_t crcLength)
+{
+	uint32_t bits = 8 + 8 * addressLength + 9 + 8 * length + 8 * crcLength;
+
+	switch (rate)
+	{
+		case MBPS_2:   return (uint64_t)(bits + 8) * 500;
+		case KBPS_250: return (uint64_t)bits * 4000;
+		default:	   return (uint64_t)bits * 1000;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Pins and bus
+//////////////////////////////////////////////////////////////////////////
+
+// What the chip clocks out with the next byte, it doesn't depend on the byte clocked in
+static uint8_t Response(NrfSimDevice* device)
+{
+	// Nobody is driving MISO
+	if (device->csn)
+		return 0xFF;
+
+	// First byte is the command, STATUS is shifted out at the same time
+	if (device->byteIndex == 0)
+		return Status(device);
+
+	uint8_t command = device->command;
+	uint8_t index = device->byteIndex - 1;
+
+	if (command <= (R_REGISTER | REGISTER_MASK))
+		return ReadRegisterByte(device, command & REGISTER_MASK, index);
+	if (command == R_RX_PL_WID)
+		return device->rxCount ? device->rxFifo[0].length : 0;
+	if (command == R_RX_PAYLOAD && device->rxCount && index < device->rxFifo[0].length)
+		return device->rxFifo[0].data[index];
+
+	return 0;
+}
+
+// Takes a byte clocked in
+static void ClockIn(NrfSimDevice* device, uint8_t data)
+{
+	if (device->csn)
+	{
+		NrfSimAdvance(SpiByteNs);
+		return;
+	}
+
+	uint8_t command = device->command;
+
+	device->stats.spiBytes++;
+	device->stats.spiTimeNs += SpiByteNs;
+
+	if (device->byteIndex == 0)
+	{
+		device->command = data;
+		device->staging.length = 0;
+	}
+	else
+	{
+		uint8_t index = device->byteIndex - 1;
+
+		if (command > (R_REGISTER | REGISTER_MASK) && command <= (W_REGISTER | REGISTER_MASK))
+		{
+			WriteRegisterByte(device, command & REGISTER_MASK, index, data);
+			UpdateIrq(device);
+			Kick(device);
+		}
+		else if (command == W_TX_PAYLOAD || command == W_TX_PAYLOAD_NOACK ||
+				 (command & ~0x07) == W_ACK_PAYLOAD)
+		{
+			if (index < MAXIMUM_PAYLOAD_SIZE)
+			{
+				device->staging.data[index] = data;
+				device->staging.length = index + 1;
+			}
+		}
+	}
+
+	if (device->byteIndex < 0xFF)
+		device->byteIndex++;
+
+	NrfSimAdvance(SpiByteNs);
+}
+
+// Shifts one byte to the selected chip and returns what it clocked out
+uint8_t NrfSimShift(uint8_t data)
+{
+	NrfSimDevice* device = NrfSimSelected();
+
+	uint8_t response = Response(device);
+	ClockIn(device, data);
+
+	return response;
+}
+
+// Bit-banged bus (SPI mode 0, MSB first): MOSI is sampled on the rising edge of SCK and MISO shows
+// the bit being shifted. Eight rising edges make a byte, taken like NrfSimShift() takes it.
+// Returns the level of MISO
+uint8_t NrfSimSetSCK(uint8_t level, uint8_t mosi)
+{
+	NrfSimDevice* device = NrfSimSelected();
+	level = level ? 1 : 0;
+
+	if (level == device->sck)
+		return device->miso;
+
+	device->sck = level;
+
+	if (level)
+	{
+		if (device->bitCount == 0)
+			device->bitsOut = Response(device);
+
+		device->miso = (device->bitsOut >> (7 - device->bitCount)) & 1;
+		device->bitsIn = (device->bitsIn << 1) | (mosi ? 1 : 0);
+
+		if (++device->bitCount == 8)
+		{
+			device->bitCount = 0;
+			ClockIn(device, device->bitsIn);
+		}
+	}
+
+	return device->miso;
+}
+
+void NrfSimSetCE(uint8_t level)
+{
+	NrfSimDevice* device = NrfSimSelected();
+
+	if (level && !device->ce)
+		device->rxStartNs = Now;
+
+	device->ce = level ? 1 : 0;
+	Kick(device);
+}
+
+// CSN going high completes the command
+void NrfSimSetCSN(uint8_t level)
+{
+	NrfSimDevice* device = NrfSimSelected();
+	level = level ? 1 : 0;
+
+	if (device->csn == level)
+		return;
+
+	device->csn = level;
+
+	if (level == 0)
+	{
+		device->byteIndex = 0;
+		device->bitCount = 0;
+		device->stats.csnFrames++;
+		return;
+	}
+
+	// Nothing has been shifted
+	if (device->byteIndex == 0)
+		return;
+
+	uint8_t command = device->command;
+	uint8_t dataBytes = device->byteIndex - 1;
+
+	if (command == R_RX_PAYLOAD && dataBytes && device->rxCount)
+	{
+		FifoPop(device->rxFifo, &device->rxCount, 0);
+	}
+	else if ((command == W_TX_PAYLOAD || command == W_TX_PAYLOAD_NOACK || (command & ~0x07) == W_ACK_PAYLOAD) &&
+			 device->staging.length && device->txCount < NRF_SIM_FIFO_DEPTH)
+	{
+		NrfSimPayload* payload = &device->txFifo[device->txCount++];
+		*payload = device->staging;
+		payload->noAck = command == W_TX_PAYLOAD_NOACK;
+		payload->ackPayload = (command & ~0x07) == W_ACK_PAYLOAD;
+		payload->pipe = command & 0x07;
+		device->txReuse = 0;
+	}
+	else if (command == FLUSH_TX)
+	{
+		device->txCount = 0;
+		device->txReuse = 0;
+		device->txActive = 0;
+	}
+	else if (command == FLUSH_RX)
+	{
+		device->rxCount = 0;
+	}
+	else if (command == REUSE_TX_PL)
+	{
+		device->txReuse = 1;
+	}
+
+	UpdateIrq(device);
+	Kick(device);
+}
+
+// Routes the IRQ line to a host pin register and an interrupt routine
+void NrfSimBindIrq(NrfSimDevice* device, volatile uint8_t* pin, uint8_t bit, void (*isr)(void))
+{
+	device->irqPin = pin;
+	device->irqBit = bit;
+	device->isr = isr;
+
+	if (pin)
+	{
+		if (device->irq)
+			*pin |= (1 << bit);
+		else
+			*pin &= ~(1 << bit);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Direct access
+//////////////////////////////////////////////////////////////////////////
+
+// Writes a single-byte register without going through SPI
+void NrfSimPoke(NrfSimDevice* device, uint8_t reg, uint8_t value)
+{
+	WriteRegisterByte(device, reg & REGISTER_MASK, 0, value);
+	UpdateIrq(device);
+	Kick(device);
+}
+
+uint8_t NrfSimPeek(NrfSimDevice* device, uint8_t reg)
+{
+	return ReadRegisterByte(device, reg & REGISTER_MASK, 0);
+}
+
+// Writes a 5-byte address register (RX_ADDR_P0, RX_ADDR_P1 or TX_ADDR)
+void NrfSimSetAddress(NrfSimDevice* device, uint8_t reg, const uint8_t* address)
+{
+	uint8_t* destination = AddressRegister(device, reg);
+	if (destination)
+		memcpy(destination, address, 5);
+}
+
+void NrfSimResetStats(NrfSimDevice* device)
+{
+	memset(&device->stats, 0, sizeof(NrfSimStats));
+}
+
+// Makes the chip drop its received payloads right away (counted in rxPackets),
+// so a receiver without any host code never fills its RX FIFO and keeps acknowledging
+void NrfSimSetSink(NrfSimDevice* device, uint8_t onOff)
+{
+	device->rxSink = onOff ? 1 : 0;
+}
+
+// Resets the chip like a supply dip would: registers to reset values, FIFOs empty, powered down
+// Pins, the IRQ routing and the counters stay
+void NrfSimBrownOut(NrfSimDevice* device)
+{
+	NrfSimDevice kept = *device;
+
+	DeviceReset(device);
+	device->ce = kept.ce;
+	device->csn = kept.csn;
+	device->sck = kept.sck;
+	device->rxSink = kept.rxSink;
+	device->irqPin = kept.irqPin;
+	device->irqBit = kept.irqBit;
+	device->isr = kept.isr;
+	device->stats = kept.stats;
+	UpdateIrq(device);
+}
@@ -0,0 +1,167 @@
+// Host-side model of the nRF24L01+ used for off-target builds and benchmarking.
+// Models the register map, both 3-level FIFOs, STATUS/FIFO_STATUS flags, the IRQ line,
+// Enhanced ShockBurst auto-ACK/retransmission and on-air timing.
+// Every simulated chip shares one clock; SPI bytes, delays and airtime all advance it.
+
+#ifndef NRFSIM_H_
+#define NRFSIM_H_
+
+#include <stdint.h>
+
+#include "../NrfMemoryMap.h"
+
+//////////////////////////////////////////////////////////////////////////
+// Compile-time settings
+//////////////////////////////////////////////////////////////////////////
+
+// How many chips can share the simulated medium
+#define NRF_SIM_MAX_DEVICES 8
+
+// Depth of TX and RX FIFOs (3 on the real device)
+#define NRF_SIM_FIFO_DEPTH 3
+
+// Time needed by the PLL to settle before each transmission or reception (see data sheet)
+#define NRF_SIM_SETTLE_NS 130000ULL
+
+// Time in RX mode on a channel before RPD shows what's on it (see data sheet)
+#define NRF_SIM_RPD_NS 170000ULL
+
+//////////////////////////////////////////////////////////////////////////
+// Types
+//////////////////////////////////////////////////////////////////////////
+
+// Packet as seen on air
+typedef struct
+{
+	uint8_t channel;
+	uint8_t rate;		// RF_SETUP speed bits, one of MBPS_1, MBPS_2, KBPS_250
+	uint8_t address[5];
+	uint8_t addressLength;
+	uint8_t pid;
+	uint8_t noAck;
+	uint8_t length;
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+} NrfSimFrame;
+
+// FIFO entry
+typedef struct
+{
+	uint8_t length;
+	uint8_t pipe;		// RX: pipe the payload arrived on, TX: pipe of an ACK payload
+	uint8_t noAck;
+	uint8_t ackPayload;
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+} NrfSimPayload;
+
+// Counters used to track bus and air usage
+typedef struct
+{
+	uint32_t csnFrames;		// SPI transactions (CSN low-high cycles)
+	uint32_t spiBytes;		// Bytes shifted over SPI
+	uint64_t spiTimeNs;		// Time spent shifting those bytes
+	uint64_t airtimeNs;		// Time the transmitter spent on air (packets and ACKs)
+	uint32_t txPackets;		// Payloads that left the TX FIFO successfully
+	uint32_t txAttempts;	// Every transmission including retransmissions
+	uint32_t txFailed;		// MAX_RT events
+	uint32_t rxPackets;		// Payloads stored in RX FIFO
+	uint32_t rxDropped;		// Payloads lost because RX FIFO was full
+	uint32_t irqEdges;		// Falling edges on the IRQ line
+} NrfSimStats;
+
+typedef struct
+{
+	// Single-byte registers, indexed by register address
+	uint8_t registers[0x20];
+
+	// Multi-byte address registers
+	uint8_t rxAddressP0[5];
+	uint8_t rxAddressP1[5];
+	uint8_t txAddress[5];
+
+	NrfSimPayload txFifo[NRF_SIM_FIFO_DEPTH];
+	uint8_t txCount;
+	uint8_t txReuse;
+
+	NrfSimPayload rxFifo[NRF_SIM_FIFO_DEPTH];
+	uint8_t rxCount;
+	uint8_t rxSink;		// Received payloads are counted and dropped, like read by a fast MCU
+
+	// Pins
+	uint8_t ce;
+	uint8_t csn;
+	uint8_t irq;
+	uint8_t sck;
+	uint8_t miso;
+
+	// Byte being bit-banged with NrfSimSetSCK()
+	uint8_t bitCount;
+	uint8_t bitsIn;
+	uint8_t bitsOut;
+
+	// Command currently clocked in
+	uint8_t command;
+	uint8_t byteIndex;
+	NrfSimPayload staging;
+
+	// Transmitter
+	uint8_t txActive;
+	uint8_t txWaitingAck;
+	uint64_t txEventNs;
+	uint8_t txAttempt;
+	uint8_t txPid;
+	uint8_t txAcked;
+	NrfSimPayload txAckPayload;
+
+	// When the receiver started listening on the current channel, for RPD
+	uint64_t rxStartNs;
+
+	// Receiver duplicate detection
+	uint8_t lastPid[6];
+	uint16_t lastCrc[6];
+
+	// IRQ routing to the host code
+	volatile uint8_t* irqPin;
+	uint8_t irqBit;
+	void (*isr)(void);
+
+	NrfSimStats stats;
+} NrfSimDevice;
+
+//////////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////////
+
+// Chips and medium
+void NrfSimReset(void);
+NrfSimDevice* NrfSimAddDevice(void);
+void NrfSimSelect(NrfSimDevice* device);
+NrfSimDevice* NrfSimSelected(void);
+void NrfSimSetLoss(uint16_t framePermille, uint16_t ackPermille);
+void NrfSimSetNoise(uint8_t channel, uint16_t permille);
+void NrfSimSetPathLoss(uint8_t dB);
+void NrfSimSetPeer(uint8_t (*peer)(const NrfSimFrame* frame, NrfSimPayload* ackPayload));
+uint8_t NrfSimInject(const NrfSimFrame* frame, NrfSimPayload* ackPayload);
+
+// Clock
+uint64_t NrfSimNanos(void);
+uint32_t NrfSimMicros(void);
+void NrfSimAdvance(uint64_t ns);
+void NrfSimSetSpiClock(uint32_t hz);
+uint64_t NrfSimAirtimeNs(uint8_t rate, uint8_t addressLength, uint8_t length, uint8_t crcLength);
+
+// Pins and bus of the selected chip
+uint8_t NrfSimShift(uint8_t data);
+uint8_t NrfSimSetSCK(uint8_t level, uint8_t mosi);
+void NrfSimSetCE(uint8_t level);
+void NrfSimSetCSN(uint8_t level);
+void NrfSimBindIrq(NrfSimDevice* device, volatile uint8_t* pin, uint8_t bit, void (*isr)(void));
+
+// Direct access for test benches
+void NrfSimPoke(NrfSimDevice* device, uint8_t reg, uint8_t value);
+uint8_t NrfSimPeek(NrfSimDevice* device, uint8_t reg);
+void NrfSimSetAddress(NrfSimDevice* device, uint8_t reg, const uint8_t* address);
+void NrfSimResetStats(NrfSimDevice* device);
+void NrfSimSetSink(NrfSimDevice* device, uint8_t onOff);
+void NrfSimBrownOut(NrfSimDevice* device);
+
+#endif /* NRFSIM_H_ */
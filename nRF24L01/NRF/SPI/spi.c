@@ -6,9 +6,29 @@
  */ 
 #include "../../Common/Common.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <util/atomic.h>
 
 #include "spi.h"
 
+#if SOFT_SPI != 0 && SIM_SPI != 0
+// SCK edge for the simulated device, MOSI is taken from the port, MISO goes to the pin
+static inline void SoftClock(uint8_t level)
+{
+	if (level)
+		PORT(SCK_PORT) |= (1<<SCK);
+	else
+		PORT(SCK_PORT) &= ~(1<<SCK);
+	
+	if (NrfSimSetSCK(level, PORT(MOSI_PORT) & (1<<MOSI)))
+		PIN(MISO_PORT) |= (1<<MISO);
+	else
+		PIN(MISO_PORT) &= ~(1<<MISO);
+}
+#endif
+
 // Initializes SPI, needs to be called to enable communication
 void SpiInitialize(void)
 {
@@ -19,6 +39,11 @@ void SpiInitialize(void)
 	// MISO input
 	DDR(MISO_PORT) &= ~(1<<MISO);
 	
+	// SPI mode 0 - clock idles low
+	#if SOFT_SPI != 0
+	SCK_0;
+	#endif
+	
 	// SS need to be output
 	DDRB |= (1<<PB2);
 
@@ -29,20 +54,117 @@ void SpiInitialize(void)
 		    (0<<SPIE)|              // SPI Interrupt Enable
 		    (0<<DORD)|              // Data Order (0:MSB first / 1:LSB first)
 		    (1<<MSTR)|              // Master/Slave select
-		    (0<<SPR1)|(1<<SPR0)|    // SPI Clock Rate --> fOSC/16
+		    (SPI_SPR<<SPR0)|        // SPI Clock Rate --> see SPI_CLOCK_DIV
 		    (0<<CPOL)|              // Clock Polarity (0:SCK low / 1:SCK hi when idle)
 		    (0<<CPHA));             // Clock Phase (0:leading / 1:trailing edge sampling)
 
-    SPSR = (1<<SPI2X);              // Double the speed
+    SPSR = (SPI_DOUBLE<<SPI2X);     // Double the speed
+	
+	#endif
+	
+	// Simulated device needs to know the bus clock to count transfer times
+	#if SIM_SPI != 0 && SOFT_SPI != 0
+	
+	NrfSimSetSpiClock(F_CPU * 8 / SOFT_SPI_CYCLES_PER_BYTE);
+	
+	#elif SIM_SPI != 0
+	
+	static const uint8_t dividers[] = { 4, 16, 64, 128 };
+	uint32_t clock = F_CPU / dividers[SPCR & ((1<<SPR1)|(1<<SPR0))];
+	
+	if (SPSR & (1<<SPI2X))
+		clock *= 2;
+	
+	NrfSimSetSpiClock(clock);
 	
 	#endif
 }
 
+#if SOFT_SPI != 0
+//////////////////////////////////////////////////////////////////////////
+// Soft SPI, mode 0, MSB first
+// MOSI is set before SCK rises, the device samples it on the rising edge and changes MISO
+// on the falling edge. Bits are unrolled, pins are constants so every access is a single sbi/cbi/sbic.
+//////////////////////////////////////////////////////////////////////////
+#define SOFT_BIT(data, response, bit) do {	\
+	if ((data) & (1<<(bit))) MOSI_1;		\
+	else MOSI_0;							\
+	SCK_1;									\
+	if (MISO_CHECK) (response) |= (1<<(bit));\
+	SCK_0;									\
+} while (0)
+
+#define SOFT_BIT_OUT(data, bit) do {		\
+	if ((data) & (1<<(bit))) MOSI_1;		\
+	else MOSI_0;							\
+	SCK_1;									\
+	SCK_0;									\
+} while (0)
+
+// MOSI is left as it is
+#define SOFT_BIT_IN(response, bit) do {		\
+	SCK_1;									\
+	if (MISO_CHECK) (response) |= (1<<(bit));\
+	SCK_0;									\
+} while (0)
+
+static inline uint8_t SoftShift(uint8_t data)
+{
+	uint8_t response = 0;
+	SOFT_BIT(data, response, 7);
+	SOFT_BIT(data, response, 6);
+	SOFT_BIT(data, response, 5);
+	SOFT_BIT(data, response, 4);
+	SOFT_BIT(data, response, 3);
+	SOFT_BIT(data, response, 2);
+	SOFT_BIT(data, response, 1);
+	SOFT_BIT(data, response, 0);
+	return response;
+}
+
+static inline void SoftWrite(uint8_t data)
+{
+	SOFT_BIT_OUT(data, 7);
+	SOFT_BIT_OUT(data, 6);
+	SOFT_BIT_OUT(data, 5);
+	SOFT_BIT_OUT(data, 4);
+	SOFT_BIT_OUT(data, 3);
+	SOFT_BIT_OUT(data, 2);
+	SOFT_BIT_OUT(data, 1);
+	SOFT_BIT_OUT(data, 0);
+}
+
+// Sends a byte of all zeros or all ones (MOSI set by the caller)
+static inline uint8_t SoftRead(void)
+{
+	uint8_t response = 0;
+	SOFT_BIT_IN(response, 7);
+	SOFT_BIT_IN(response, 6);
+	SOFT_BIT_IN(response, 5);
+	SOFT_BIT_IN(response, 4);
+	SOFT_BIT_IN(response, 3);
+	SOFT_BIT_IN(response, 2);
+	SOFT_BIT_IN(response, 1);
+	SOFT_BIT_IN(response, 0);
+	return response;
+}
+#endif
+
 // Basic, low-level SPI shift
 uint8_t SpiShift(uint8_t data)
 {
+	// Byte-by-byte calls pay the call and loop overhead on top of the shift
+	#if SIM_SPI != 0
+	NrfSimAdvance(SPI_SHIFT_OVERHEAD_NS);
+	#endif
+	
+	// Simulated device
+	#if SIM_SPI != 0 && SOFT_SPI == 0
+	
+	return NrfSimShift(data);
+	
 	// Hardware SPI
-	#if SOFT_SPI == 0
+	#elif SOFT_SPI == 0
 	
 	// Load the data
 	SPDR = data;
@@ -56,37 +178,318 @@ uint8_t SpiShift(uint8_t data)
 	// Software SPI
 	#else
 	
-	uint8_t counter = 0x80;
-	uint8_t response = 0;
+	return SoftShift(data);
 	
-	SCK_0;
+	#endif
+}
 
-	// Send what we got and save any response from the device
-	while(counter)
+//////////////////////////////////////////////////////////////////////////
+// Block transfers
+// Hardware versions fetch the next byte while the current one is on the bus and reload SPDR
+// right after SPIF sets, so per-byte overhead is hidden behind the shift.
+//////////////////////////////////////////////////////////////////////////
+
+// Sends length bytes from tx and saves what's received to rx
+void SpiTransfer(const uint8_t* tx, uint8_t* rx, uint8_t length)
+{
+	if (length == 0)
+		return;
+	
+	#if SIM_SPI != 0
+	NrfSimAdvance(SPI_BLOCK_OVERHEAD_NS);
+	#endif
+	
+	#if SIM_SPI != 0 && SOFT_SPI == 0
+	
+	while (length--)
+		*rx++ = NrfSimShift(*tx++);
+	
+	#elif SOFT_SPI == 0
+	
+	SPDR = *tx++;
+	while (--length)
 	{
-		if (data & counter) MOSI_1;
-		else MOSI_0;
+		uint8_t next = *tx++;
+		while(!(SPSR & (1<<SPIF)));
+		uint8_t received = SPDR;
+		SPDR = next;
+		*rx++ = received;
+	}
+	while(!(SPSR & (1<<SPIF)));
+	*rx = SPDR;
+	
+	#else
+	
+	while (length--)
+		*rx++ = SoftShift(*tx++);
+	
+	#endif
+}
 
-		SCK_0;
-		SCK_1;
+// Sends length bytes from tx, discards what's received
+void SpiWrite(const uint8_t* tx, uint8_t length)
+{
+	if (length == 0)
+		return;
+	
+	#if SIM_SPI != 0
+	NrfSimAdvance(SPI_BLOCK_OVERHEAD_NS);
+	#endif
+	
+	#if SIM_SPI != 0 && SOFT_SPI == 0
+	
+	while (length--)
+		NrfSimShift(*tx++);
+	
+	#elif SOFT_SPI == 0
+	
+	SPDR = *tx++;
+	while (--length)
+	{
+		uint8_t next = *tx++;
+		while(!(SPSR & (1<<SPIF)));
+		SPDR = next;
+	}
+	while(!(SPSR & (1<<SPIF)));
+	
+	// Reading SPDR completes clearing SPIF
+	(void)SPDR;
+	
+	#else
+	
+	while (length--)
+		SoftWrite(*tx++);
+	
+	#endif
+}
 
-		response |= MISO_CHECK;
-		
-		response <<= 1;
+// Same as SpiWrite(), tx is in program memory
+void SpiWrite_P(const uint8_t* tx, uint8_t length)
+{
+	if (length == 0)
+		return;
+	
+	#if SIM_SPI != 0
+	NrfSimAdvance(SPI_BLOCK_OVERHEAD_NS);
+	#endif
+	
+	#if SIM_SPI != 0 && SOFT_SPI == 0
+	
+	while (length--)
+		NrfSimShift(pgm_read_byte(tx++));
+	
+	#elif SOFT_SPI == 0
+	
+	SPDR = pgm_read_byte(tx++);
+	while (--length)
+	{
+		uint8_t next = pgm_read_byte(tx++);
+		while(!(SPSR & (1<<SPIF)));
+		SPDR = next;
+	}
+	while(!(SPSR & (1<<SPIF)));
+	(void)SPDR;
+	
+	#else
+	
+	while (length--)
+		SoftWrite(pgm_read_byte(tx++));
+	
+	#endif
+}
+
+// Receives length bytes to rx, sending filler (i.e. NOP) meanwhile
+void SpiRead(uint8_t* rx, uint8_t length, uint8_t filler)
+{
+	if (length == 0)
+		return;
+	
+	#if SIM_SPI != 0
+	NrfSimAdvance(SPI_BLOCK_OVERHEAD_NS);
+	#endif
+	
+	#if SIM_SPI != 0 && SOFT_SPI == 0
+	
+	while (length--)
+		*rx++ = NrfSimShift(filler);
+	
+	#elif SOFT_SPI == 0
+	
+	SPDR = filler;
+	while (--length)
+	{
+		while(!(SPSR & (1<<SPIF)));
+		uint8_t received = SPDR;
+		SPDR = filler;
+		*rx++ = received;
+	}
+	while(!(SPSR & (1<<SPIF)));
+	*rx = SPDR;
+	
+	#else
+	
+	// Burst of constant filler - MOSI doesn't move
+	if (filler == 0x00 || filler == 0xFF)
+	{
+		if (filler)
+			MOSI_1;
+		else
+			MOSI_0;
 		
-		counter >>= 1;
+		while (length--)
+			*rx++ = SoftRead();
 	}
+	else
+	{
+		while (length--)
+			*rx++ = SoftShift(filler);
+	}
+	
+	#endif
+}
 
-	SCK_0;
+//////////////////////////////////////////////////////////////////////////
+// Asynchronous transfers
+//////////////////////////////////////////////////////////////////////////
+#if SPI_ASYNC != 0
 
-	// Flip the received data
-	// 1101|0001 => 0001|1101
-	uint8_t helper = response & 0x0F;
-	response >>= 4;
-	helper <<= 4;
-	response |= helper;
+// Queue of submitted jobs, head is the one being shifted
+static SpiJob* volatile QueueHead = NULL;
+static SpiJob* volatile QueueTail = NULL;
 
-	return response;
+// Bytes of the current job shifted so far (0 - command byte is on the bus)
+static volatile uint8_t JobIndex;
+
+// Set while a job is on the bus
+static volatile uint8_t Running = 0;
+
+// Selects and deselects the device, provided by the device driver
+static void (*ChipSelect)(uint8_t selected);
+
+#if SIM_SPI != 0
+// Simulated device has no SPI interrupt, bytes loaded are shifted by SpiSubmit() in a loop
+static uint8_t PendingByte;
+static uint8_t Pending = 0;
+#define SPI_LOAD(x) do { PendingByte = (x); Pending = 1; } while (0)
+#else
+#define SPI_LOAD(x) SPDR = (x)
+#endif
+
+// Registers method driving the device's chip select (SS/CSN) line
+void SpiSetChipSelect(void (*chipSelect)(uint8_t selected))
+{
+	ChipSelect = chipSelect;
+}
+
+// Puts the head job on the bus
+static void SpiStart(void)
+{
+	SpiJob* job = QueueHead;
 	
+	Running = 1;
+	JobIndex = 0;
+	
+	if (ChipSelect)
+		ChipSelect(1);
+	
+	#if SIM_SPI == 0
+	SPCR |= (1<<SPIE);
+	#endif
+	
+	SPI_LOAD(job->command);
+}
+
+// Handles a byte that has just been shifted
+static void SpiStep(uint8_t received)
+{
+	SpiJob* job = QueueHead;
+	
+	if (JobIndex == 0)
+		job->status = received;
+	else if (job->rx)
+		job->rx[JobIndex - 1] = received;
+	
+	// Load the next byte as soon as possible
+	if (JobIndex < job->length)
+	{
+		SPI_LOAD(job->tx ? job->tx[JobIndex] : 0xFF);
+		JobIndex++;
+		return;
+	}
+	
+	if (ChipSelect)
+		ChipSelect(0);
+	
+	// Take the job off the queue before the callback, so it can be submitted again
+	QueueHead = job->next;
+	if (QueueHead == NULL)
+		QueueTail = NULL;
+	
+	Running = 0;
+	
+	if (QueueHead)
+		SpiStart();
+	#if SIM_SPI == 0
+	else
+		SPCR &= ~(1<<SPIE);
+	#endif
+	
+	if (job->complete)
+		job->complete(job);
+}
+
+// Queues the job, it starts as soon as the bus is free
+void SpiSubmit(SpiJob* job)
+{
+	uint8_t start = 0;
+	
+	job->next = NULL;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (QueueTail)
+			QueueTail->next = job;
+		else
+			QueueHead = job;
+		QueueTail = job;
+		
+		if (!Running)
+		{
+			SpiStart();
+			start = 1;
+		}
+	}
+	
+	#if SIM_SPI != 0
+	// Shift everything right away
+	while (start && Pending)
+	{
+		Pending = 0;
+		SpiStep(NrfSimShift(PendingByte));
+	}
+	#else
+	(void)start;
 	#endif
-}
\ No newline at end of file
+}
+
+uint8_t SpiIsBusy(void)
+{
+	return Running;
+}
+
+// Blocks until all the queued jobs are done
+// Must be called before any blocking transfer
+void SpiWaitIdle(void)
+{
+	while (Running);
+}
+
+#if SIM_SPI == 0
+// Transfer complete
+ISR(SPI_STC_vect)
+{
+	SpiStep(SPDR);
+}
+#endif
+
+#endif
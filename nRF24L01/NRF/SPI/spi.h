@@ -12,9 +12,32 @@
 // Compile-time settings
 //////////////////////////////////////////////////////////////////////////
 
-// != 0	- soft SPI
+// != 0	- soft SPI (any pins, see MOSI/MISO/SCK below)
 // 0	- hardware SPI
+#ifndef SOFT_SPI
 #define SOFT_SPI 0
+#endif
+
+// != 0	- simulated device (see SIM/nrfsim.h), used for host builds
+// 0	- real device
+#ifndef SIM_SPI
+#ifdef __AVR__
+#define SIM_SPI 0
+#else
+#define SIM_SPI 1
+#endif
+#endif
+
+// != 0	- interrupt driven transfers with SpiSubmit() (hardware SPI only, needs sei())
+// 0	- blocking transfers only
+#ifndef SPI_ASYNC
+#define SPI_ASYNC 0
+#endif
+
+// Hardware SPI clock divider: 2, 4, 8, 16, 32, 64 or 128 (device takes up to 10MHz)
+#ifndef SPI_CLOCK_DIV
+#define SPI_CLOCK_DIV 8
+#endif
 
 #define MOSI_PORT B
 #define MOSI 3
@@ -29,18 +52,91 @@
 // Helper macros
 //////////////////////////////////////////////////////////////////////////
 
-#if SOFT_SPI == 1
+// SPR1:SPR0 and SPI2X for the selected clock divider
+#if SPI_CLOCK_DIV == 2
+#define SPI_SPR 0
+#define SPI_DOUBLE 1
+#elif SPI_CLOCK_DIV == 4
+#define SPI_SPR 0
+#define SPI_DOUBLE 0
+#elif SPI_CLOCK_DIV == 8
+#define SPI_SPR 1
+#define SPI_DOUBLE 1
+#elif SPI_CLOCK_DIV == 16
+#define SPI_SPR 1
+#define SPI_DOUBLE 0
+#elif SPI_CLOCK_DIV == 32
+#define SPI_SPR 2
+#define SPI_DOUBLE 1
+#elif SPI_CLOCK_DIV == 64
+#define SPI_SPR 2
+#define SPI_DOUBLE 0
+#elif SPI_CLOCK_DIV == 128
+#define SPI_SPR 3
+#define SPI_DOUBLE 0
+#else
+#error "SPI_CLOCK_DIV must be 2, 4, 8, 16, 32, 64 or 128!"
+#endif
+
+#if SOFT_SPI != 0
 
+#if SIM_SPI != 0
+// The simulated device gets the SCK edges through SoftClock() in spi.c, it drives the MISO pin back
+#define SCK_0 SoftClock(0)
+#define SCK_1 SoftClock(1)
+#else
 #define SCK_0 PORT(SCK_PORT) &= ~(1<<SCK)
 #define SCK_1 PORT(SCK_PORT) |= (1<<SCK)
+#endif
 
 #define MOSI_0 PORT(MOSI_PORT) &= ~(1<<MOSI)
 #define MOSI_1 PORT(MOSI_PORT) |= (1<<MOSI)
 
-#define MISO_CHECK !(PIN(MISO_PORT) & (1<<MISO))
+#define MISO_CHECK (PIN(MISO_PORT) & (1<<MISO))
 
 #endif
 
+#if SIM_SPI != 0
+#include "../SIM/nrfsim.h"
+#endif
+
+#if SIM_SPI != 0
+// CPU time the simulator adds on top of the shift itself
+// ESTIMATES, counted by hand from instruction timings at F_CPU, not measured on the target:
+// SpiShift() called per byte - call, return, SPDR/SPSR access and caller's loop (~20 cycles)
+// Block transfers - setup once per call, per-byte work is hidden behind the shift (~10 cycles)
+// The bench's cycles_per_byte is the bus time plus these, so it can't tell which is faster, the SPI counts can
+#define SPI_SHIFT_OVERHEAD_NS (20 * 1000000000ULL / F_CPU)
+#define SPI_BLOCK_OVERHEAD_NS (10 * 1000000000ULL / F_CPU)
+
+// Soft SPI byte: 8 unrolled bits of MOSI set/clear, SCK high, MISO test, SCK low
+// ESTIMATE, counted by hand from sbrs/sbi/cbi/sbic timings (~11 cycles per bit), not measured on the target
+// SpiShift() may take a few cycles more per bit, the write-only and read-only block loops a few less
+// The bit-banging itself runs against the simulator, only its timing comes from here
+#define SOFT_SPI_CYCLES_PER_BYTE 88
+#endif
+
+#if SPI_ASYNC != 0 && SOFT_SPI != 0 && SIM_SPI == 0
+#error "SPI_ASYNC needs hardware SPI!"
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Types
+//////////////////////////////////////////////////////////////////////////
+
+// Asynchronous transfer: command byte followed by length data bytes, all with chip selected
+// The job must stay untouched until its callback is called
+typedef struct SpiJob
+{
+	uint8_t command;
+	const uint8_t* tx;					// Data to send, NULL sends NOPs (0xFF)
+	uint8_t* rx;						// Where to save received data, NULL discards it
+	uint8_t length;
+	uint8_t status;						// Byte received with the command
+	void (*complete)(struct SpiJob*);	// Called from the interrupt when done, optional
+	struct SpiJob* next;
+} SpiJob;
+
 //////////////////////////////////////////////////////////////////////////
 // Methods
 //////////////////////////////////////////////////////////////////////////
@@ -51,4 +147,18 @@ void SpiInitialize(void);
 // Fast shift
 uint8_t SpiShift(uint8_t data);
 
+// Block transfers
+void SpiTransfer(const uint8_t* tx, uint8_t* rx, uint8_t length);
+void SpiWrite(const uint8_t* tx, uint8_t length);
+void SpiWrite_P(const uint8_t* tx, uint8_t length);
+void SpiRead(uint8_t* rx, uint8_t length, uint8_t filler);
+
+#if SPI_ASYNC != 0
+// Asynchronous transfers
+void SpiSetChipSelect(void (*chipSelect)(uint8_t selected));
+void SpiSubmit(SpiJob* job);
+uint8_t SpiIsBusy(void);
+void SpiWaitIdle(void);
+#endif
+
 #endif /* SPI_H_ */
\ No newline at end of file
@@ -29,25 +29,217 @@ volatile uint8_t ReceivedDataReady = 0;
 uint8_t RXBuffer[MAXIMUM_PAYLOAD_SIZE + 1];
 
 // Pointer to a callback function defined by the user
-static void (*ReceiverCallback)(uint8_t*, uint8_t);
+static void (*ReceiverCallback)(uint8_t*, uint8_t, uint8_t);
+
+// Callbacks of the data pipes, ReceiverCallback gets payloads of the pipes without one
+static void (*PipeCallbacks[6])(uint8_t*, uint8_t, uint8_t);
 
 // Device state as a variable
 volatile uint8_t State = POWER_DOWN;
 
+// State the device gets to once SETTLING is over, and RADIO_TICKS() when that happens
+// POWER_DOWN means the device is starting up and has to be configured first
+static uint8_t TargetState;
+static uint16_t SettleDeadline;
+
+// STATUS register as clocked out by the device during the last command
+static uint8_t LastStatus = 0;
+
+// How the last RadioSend*() ended, see RadioSendResult()
+static uint8_t SendResult = SEND_DONE;
+
+// Supplies payloads while streaming, NULL once RadioStreamEnd() has been called
+static uint8_t (*StreamSource)(uint8_t*);
+
+// Payload handed over by StreamSource
+static uint8_t StreamBuffer[MAXIMUM_PAYLOAD_SIZE];
+
+// Payloads flushed after MAX_RT since RadioStreamBegin(), see RadioStreamDropped()
+static uint16_t StreamDropped = 0;
+
+// Messages waiting for a free TX FIFO slot, see RadioEnqueue()
+typedef struct
+{
+	uint8_t length;
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+} QueuedMessage;
+
+static QueuedMessage TxQueue[TX_QUEUE_SIZE];
+static uint8_t QueueHead = 0;
+static uint8_t QueueCount = 0;
+static uint8_t QueueHighWatermark = 0;
+
+static void RadioQueueKick(void);
+
+// ACK payloads waiting for the device, in order they were queued
+typedef struct
+{
+	uint8_t pipe;
+	uint8_t length;
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE];
+} AckMessage;
+
+static AckMessage AckQueue[ACK_QUEUE_SIZE];
+static uint8_t AckCount = 0;
+
+// Pipes with an ACK payload in TX FIFO (one at a time per pipe) and how many of them there are
+static uint8_t AckLoaded = 0;
+static uint8_t AckLoadedCount = 0;
+
+// Set while RX FIFO is being read, ACK payloads are loaded once it's empty
+static uint8_t AckDeferred = 0;
+
+static void RadioLoadAckPayloads(void);
+
+// RAM copy of the configuration registers, so setters don't need to read them from the device
+// See ShadowIndex() for the layout
+static uint8_t RegisterShadow[SHADOW_SIZE];
+
+// RAM copy of RX_ADDR_P0, RX_ADDR_P1 and TX_ADDR
+static uint8_t AddressShadow[3][5];
+
+// Default settings used by RadioConfig()
+const RadioConfigImage RadioDefaultConfig PROGMEM =
+{
+	// Device will send data on this address, and expects ACKs on data pipe 0 with the same address
+	.txAddress = "TEST1",
+	.rxAddressP0 = "TEST1",
+	
+	// Reset values for the remaining pipes (pipes 2-5 share 4 MSBytes with pipe 1)
+	.rxAddressP1 = { 0xC2, 0xC2, 0xC2, 0xC2, 0xC2 },
+	.rxAddressLsb = { 0xC3, 0xC4, 0xC5, 0xC6 },
+	
+	.addressWidth = RX_ADDRESS_LENGTH - 2,
+	
+	// Only data pipe 0 is used, with auto ACK and dynamic payload width
+	.enabledPipes = (1<<ERX_P0),
+	.autoAck = (1<<ENAA_P0),
+	.payloadWidth = { 0, 0, 0, 0, 0, 0 },
+	.dynamicPayload = (1<<DPL_P0),
+	.feature = (1<<EN_DPL),
+	
+	// 1 byte CRC, interrupts depending on USE_IRQ
+#if USE_IRQ == 0
+	.config = (1<<EN_CRC) | INTERRUPTS_MASK,
+#else
+	.config = (1<<EN_CRC),
+#endif
+	
+	// Retransmission settings
+	// NOTE (copied from data sheet): If the ACK payload is more than 15 byte in 2Mbps mode the
+	// ARD must be 500S or more, if the ACK payload is more than 5byte in 1Mbps mode the ARD must be
+	// 500S or more. In 250kbps mode (even when the payload is not in ACK) the ARD must be 500S or more.
+	.retransmission = ARD_US_4000 | ARC_10,
+	
+	// Radio channel or the frequency
+	// Device is frequency is equal to: 2.4GHz + (channel)MHz
+	// Here: 2.450 GHz
+	.channel = 50,
+	
+	// Power and speed settings
+	// 0DBM is more powerful than -18DBM (physics)
+	.rfSetup = MBPS_2 | POWER_DBM_0,
+};
+
 volatile uint8_t Role = ROLE_TRANSMITTER;
 
+// Waits for the device to get to the target state, us has to be a constant
+#if RADIO_NONBLOCKING != 0
+#define RadioSettle(us, target) RadioSchedule(RADIO_US_TO_TICKS(us), target)
+
+// Leaves the device in SETTLING state for the given number of RADIO_TICKS(), RADIO_EVENT() finishes the transition
+// A transition still running is extended, the device goes through both
+static void RadioSchedule(uint16_t ticks, uint8_t target)
+{
+	if (State == SETTLING)
+		SettleDeadline += ticks;
+	else
+		SettleDeadline = RADIO_TICKS() + ticks + 1;
+	
+	TargetState = target;
+	State = SETTLING;
+}
+#else
+#define RadioSettle(us, target) do { _delay_us(us); State = (target); } while (0)
+#endif
+
+#if SPI_ASYNC == 0
+// Starts sending TX FIFO head with a 10s high pulse on CE
+// With RADIO_NONBLOCKING CE stays high, RADIO_EVENT() clears it when the transmission is over
+static void RadioPulseCE(void)
+{
+	CE_HIGH;
+	#if RADIO_NONBLOCKING == 0
+	_delay_us(10);
+	CE_LOW;
+	#endif
+}
+#endif
+
+#if SPI_ASYNC != 0
+// Copy of the payload RadioSend() uploads in the background, so the caller can reuse its buffer
+static uint8_t TXBuffer[MAXIMUM_PAYLOAD_SIZE];
+static SpiJob PayloadJob;
+#endif
+
+#if SPI_ASYNC != 0
+// Drives CSN for asynchronous transfers, called from SPI interrupt
+static void RadioChipSelect(uint8_t selected)
+{
+	if (selected)
+		CSN_PIN_LOW;
+	else
+		CSN_PIN_HIGH;
+}
+
+// Called from SPI interrupt once RadioSend() has uploaded the payload
+// No 10s pulse here, CE stays high and RADIO_EVENT() clears it at TX_DS or MAX_RT (as with RADIO_NONBLOCKING)
+static void PayloadUploaded(SpiJob* job)
+{
+	LastStatus = job->status;
+	
+	CE_HIGH;
+}
+#endif
+
 // Registers callback function
-void RegisterRadioCallback(void (*callback)(uint8_t*, uint8_t))
+void RegisterRadioCallback(void (*callback)(uint8_t*, uint8_t, uint8_t))
 {
 	ReceiverCallback = callback;
 }
 
+// Registers callback function for payloads of one data pipe only, NULL hands them back to RegisterRadioCallback()
+void RegisterPipeCallback(uint8_t dataPipe, void (*callback)(uint8_t*, uint8_t, uint8_t))
+{
+	// Data validation
+	if (dataPipe > 5)
+		dataPipe = 5;
+	
+	PipeCallbacks[dataPipe] = callback;
+}
+
+// Device is up after the start up delay, configure it
+static void RadioStartUp(void)
+{
+	// Device may keep its settings through MCU reset, start from what it really has
+	RadioSyncRegisters();
+	
+	// Configure the device ready to use
+	RadioConfig();
+}
+
 // Initializes the device and configures it ready to use
+// NOTE: With RADIO_NONBLOCKING the device is configured by RADIO_EVENT() 200ms later,
+//		 wait for RadioIsReady() before changing any settings
 void RadioInitialize(void)
 {
 	// SPI is required to communicate with the device
 	SpiInitialize();
 	
+	#if SPI_ASYNC != 0
+	SpiSetChipSelect(RadioChipSelect);
+	#endif
+	
 	// CE and CSN - outputs
 	DDR(CE_PORT) |= (1<<CE);
 	DDR(CSN_PORT) |= (1<<CSN);
@@ -73,11 +265,16 @@ void RadioInitialize(void)
 
 	#endif
 	
+	// RADIO_TICKS() runs in every mode, LPL, HOP and ADAPT time themselves with it
+	RADIO_TIMER_START();
+	
 	// Start up delay
+	#if RADIO_NONBLOCKING != 0
+	RadioSettle(200000UL, POWER_DOWN);
+	#else
 	_delay_ms(200);
-	
-	// Configure the device ready to use
-	RadioConfig();
+	RadioStartUp();
+	#endif
 }
 
 // Configures the device with the most common settings, and settings defined in config file
@@ -87,57 +284,62 @@ void RadioConfig(void)
 	// Useful for battery powered devices
 	RadioPowerDown();
 	
-	// Device will send data on this address
-	RadioSetTransmitterAddress(PSTR("TEST1"));
-	
-	// Set receiver address for data pipe 0
-	RadioSetReceiverAddress(DATA_PIPE_0, PSTR("TEST1"));
+	// All the settings are kept in RadioDefaultConfig, only what differs from the device gets written
+	RadioCommitConfig_P(&RadioDefaultConfig);
 	
-	// You can configure data pipes like this...
-	//RadioEnableDataPipe(DATA_PIPE_0);
-	//RadioEnableAutoAck(DATA_PIPE_0);
-	
-	// Or like this...
-	RadioConfigDataPipe(DATA_PIPE_0, 1, 1);
+	// Clear device's data buffers 
+	RadioClearRX();
+	RadioClearTX();
+}
+
+// Position of the register in the shadow, -1 if it's not shadowed
+// 0-6:	  CONFIG..RF_SETUP
+// 7-10:  RX_ADDR_P2..RX_ADDR_P5
+// 11-16: RX_PW_P0..RX_PW_P5
+// 17-18: DYNPD, FEATURE
+static int8_t ShadowIndex(uint8_t reg)
+{
+	reg &= REGISTER_MASK;
 	
-	// Payload width can be either static or dynamic 
-	RadioSetDynamicPayload(DATA_PIPE_0, 1);
+	if (reg <= RF_SETUP)
+		return reg;
 	
-	// Common for all the data pipes
-	RadioEnableCRC();
-	RadioSetCRCLength(1);
+	if (reg >= RX_ADDR_P2 && reg <= RX_ADDR_P5)
+		return reg - RX_ADDR_P2 + 7;
 	
-	// Retransmission settings
-	// NOTE (copied from data sheet): If the ACK payload is more than 15 byte in 2Mbps mode the
-	// ARD must be 500?S or more, if the ACK payload is more than 5byte in 1Mbps mode the ARD must be
-	// 500?S or more. In 250kbps mode (even when the payload is not in ACK) the ARD must be 500?S or more.
-	RadioConfigRetransmission(ARD_US_4000, ARC_10);
+	if (reg >= RX_PW_P0 && reg <= RX_PW_P5)
+		return reg - RX_PW_P0 + 11;
 	
-	// Configure interrupts settings
-	RadioConfigureInterrupts();
+	if (reg == DYNPD || reg == FEATURE)
+		return reg - DYNPD + 17;
 	
-	// Power and speed settings
-	// 0DBM is more powerful than -18DBM (physics)
-	RadioSetPower(POWER_DBM_0);
-	RadioSetSpeed(MBPS_2);
+	return -1;
+}
 
-	// Radio channel or the frequency
-	// Device is frequency is equal to: 2.4GHz + (this method's argument value)MHz
-	// Here: 2.450 GHz
-	RadioSetChannel(50);
-	
-	// Clear device's data buffers 
-	RadioClearRX();
-	RadioClearTX();
+// Shadow of a multi-byte address register, NULL for any other register
+static uint8_t* AddressShadowOf(uint8_t reg)
+{
+	switch (reg & REGISTER_MASK)
+	{
+		case RX_ADDR_P0: return AddressShadow[0];
+		case RX_ADDR_P1: return AddressShadow[1];
+		case TX_ADDR:	 return AddressShadow[2];
+		default:		 return NULL;
+	}
+}
+
+// Length of the address kept in the register
+static uint8_t AddressLengthOf(uint8_t reg)
+{
+	return (reg & REGISTER_MASK) == TX_ADDR ? TX_ADDRESS_LENGTH : RX_ADDRESS_LENGTH;
 }
 
 // Reads register to the buffer
 void RadioReadRegister(uint8_t reg, uint8_t* buffer, uint8_t len)
 {
 	CSN_LOW;
-	SpiShift(R_REGISTER | (REGISTER_MASK & reg));
-	for(uint8_t i = 0; i < len; i++)
-		buffer[i] = SpiShift(NOP);
+	LastStatus = SpiShift(R_REGISTER | (REGISTER_MASK & reg));
+	SpiRead(buffer, len, NOP);
 
 	CSN_HIGH;
 }
@@ -146,7 +348,7 @@ void RadioReadRegister(uint8_t reg, uint8_t* buffer, uint8_t len)
 uint8_t RadioReadRegisterSingle(uint8_t reg)
 {
 	CSN_LOW;
-	SpiShift(R_REGISTER | (REGISTER_MASK & reg));
+	LastStatus = SpiShift(R_REGISTER | (REGISTER_MASK & reg));
 	uint8_t respone = SpiShift(NOP);
 	CSN_HIGH;
 	return respone;
@@ -155,10 +357,18 @@ uint8_t RadioReadRegisterSingle(uint8_t reg)
 // Writes register with the given value and length
 void RadioWriteRegister(uint8_t reg, uint8_t* value, uint8_t len)
 {
+	// Keep the shadow up to date
+	int8_t index = ShadowIndex(reg);
+	uint8_t* address = AddressShadowOf(reg);
+	if (index >= 0 && len > 0)
+		RegisterShadow[index] = value[0];
+	else if (address != NULL && address != value)
+		for (uint8_t i = 0; i < len && i < 5; i++)
+			address[i] = value[i];
+	
 	CSN_LOW;
-	SpiShift(W_REGISTER | (REGISTER_MASK & reg));
-	for(uint8_t i = 0; i < len; i++)
-		SpiShift(value[i]);
+	LastStatus = SpiShift(W_REGISTER | (REGISTER_MASK & reg));
+	SpiWrite(value, len);
 
 	CSN_HIGH;
 }
@@ -166,26 +376,221 @@ void RadioWriteRegister(uint8_t reg, uint8_t* value, uint8_t len)
 // Writes a single-byte register
 void RadioWriteRegisterSingle(uint8_t reg, uint8_t value)
 {
+	// Keep the shadow up to date
+	int8_t index = ShadowIndex(reg);
+	if (index >= 0)
+		RegisterShadow[index] = value;
+	
 	CSN_LOW;
-	SpiShift(W_REGISTER | (REGISTER_MASK & reg));
+	LastStatus = SpiShift(W_REGISTER | (REGISTER_MASK & reg));
 	SpiShift(value);
 	CSN_HIGH;
 }
 
+// Returns the last value written to a shadowed register, without talking to the device
+uint8_t RadioReadShadow(uint8_t reg)
+{
+	int8_t index = ShadowIndex(reg);
+	if (index < 0)
+		return RadioReadRegisterSingle(reg);
+	
+	return RegisterShadow[index];
+}
+
+// Returns STATUS captured during the last command, no SPI traffic
+uint8_t RadioGetStatus(void)
+{
+	return LastStatus;
+}
+
+// Fetches fresh STATUS with a single byte NOP command
+uint8_t RadioNop(void)
+{
+	CSN_LOW;
+	LastStatus = SpiShift(NOP);
+	CSN_HIGH;
+	return LastStatus;
+}
+
+// Writes a single-byte register only if its value is going to change
+void RadioUpdateRegister(uint8_t reg, uint8_t value)
+{
+	int8_t index = ShadowIndex(reg);
+	if (index >= 0 && RegisterShadow[index] == value)
+		return;
+	
+	RadioWriteRegisterSingle(reg, value);
+}
+
+// Loads the shadow with the values the device really has
+void RadioSyncRegisters(void)
+{
+	for (uint8_t reg = 0; reg <= FEATURE; reg++)
+	{
+		int8_t index = ShadowIndex(reg);
+		uint8_t* address = AddressShadowOf(reg);
+		if (index >= 0)
+			RegisterShadow[index] = RadioReadRegisterSingle(reg);
+		else if (address != NULL)
+			RadioReadRegister(reg, address, AddressLengthOf(reg));
+	}
+}
+
+// Compares the shadow with the device
+// Returns the number of registers that differ (i.e. device has been reset by a brown-out)
+uint8_t RadioVerifyRegisters(void)
+{
+	uint8_t mismatches = 0;
+	uint8_t buffer[5];
+	
+	for (uint8_t reg = 0; reg <= FEATURE; reg++)
+	{
+		int8_t index = ShadowIndex(reg);
+		uint8_t* address = AddressShadowOf(reg);
+		if (index >= 0 && RegisterShadow[index] != RadioReadRegisterSingle(reg))
+		{
+			mismatches++;
+		}
+		else if (address != NULL)
+		{
+			RadioReadRegister(reg, buffer, AddressLengthOf(reg));
+			if (memcmp(buffer, address, AddressLengthOf(reg)) != 0)
+				mismatches++;
+		}
+	}
+	
+	return mismatches;
+}
+
+// Writes the whole shadow back to the device, use it to recover after RadioVerifyRegisters() found a difference
+// Same order as RadioCommitConfig(), CONFIG goes last. A device that has been reset is powered down with
+// its FIFOs empty: it's powered up again (1.5ms, SETTLING with RADIO_NONBLOCKING), a transmission or stream
+// that was on its way ends as failed and the device is left in Standby-I, or in RX mode if it was there
+void RadioRestoreRegisters(void)
+{
+	for (uint8_t reg = EN_AA; reg <= FEATURE; reg++)
+	{
+		int8_t index = ShadowIndex(reg);
+		uint8_t* address = AddressShadowOf(reg);
+		
+		// FEATURE must enable dynamic payload before DYNPD takes effect
+		if (reg == DYNPD)
+			continue;
+		
+		if (index >= 0)
+			RadioWriteRegisterSingle(reg, RegisterShadow[index]);
+		else if (address != NULL)
+			RadioWriteRegister(reg, address, AddressLengthOf(reg));
+	}
+	RadioWriteRegisterSingle(DYNPD, RadioReadShadow(DYNPD));
+	
+	uint8_t config = RadioReadShadow(CONFIG);
+	if (!(config & (1<<PWR_UP)) || (RadioReadRegisterSingle(CONFIG) & (1<<PWR_UP)))
+	{
+		RadioWriteRegisterSingle(CONFIG, config);
+		return;
+	}
+	
+	// Nothing that was in the device will report back
+	uint8_t resume = State == SETTLING ? TargetState : State;
+	CE_LOW;
+	StreamSource = NULL;
+	if (TransmissionInProgress)
+	{
+		TransmissionInProgress = 0;
+		SendResult = SEND_FAILED;
+	}
+	
+	// Power up the usual way, it waits for the device
+	RadioWriteRegisterSingle(CONFIG, config & ~(1<<PWR_UP));
+	State = POWER_DOWN;
+	RadioPowerUp();
+	
+	if (resume == RX_MODE)
+		RadioEnterRxMode();
+}
+
+// Writes an address register (RX_ADDR_P0, RX_ADDR_P1 or TX_ADDR) only if it's going to change
+// RX_ADDR_P2..P5 take value[0] through RadioUpdateRegister(), other registers are left alone
+void RadioUpdateAddress(uint8_t reg, const uint8_t* value)
+{
+	uint8_t* address = AddressShadowOf(reg);
+	uint8_t length = AddressLengthOf(reg);
+	
+	if (address == NULL)
+	{
+		if ((reg & REGISTER_MASK) >= RX_ADDR_P2 && (reg & REGISTER_MASK) <= RX_ADDR_P5)
+			RadioUpdateRegister(reg, value[0]);
+		return;
+	}
+	
+	if (memcmp(address, value, length) == 0)
+		return;
+	
+	RadioWriteRegister(reg, (uint8_t*)value, length);
+}
+
+// Applies the whole configuration, writing only the registers that differ from the device
+// Image must be in RAM, see RadioCommitConfig_P() for images kept in flash
+// NOTE: PWR_UP and PRIM_RX are left as they are, they're controlled by RadioPowerUp()/RadioEnterXxMode()
+void RadioCommitConfig(const RadioConfigImage* image)
+{
+	// Address width first, so addresses are written with the new length
+	RadioUpdateRegister(SETUP_AW, image->addressWidth);
+	
+	RadioUpdateAddress(TX_ADDR, image->txAddress);
+	RadioUpdateAddress(RX_ADDR_P0, image->rxAddressP0);
+	RadioUpdateAddress(RX_ADDR_P1, image->rxAddressP1);
+	for (uint8_t i = 0; i < 4; i++)
+		RadioUpdateRegister(RX_ADDR_P2 + i, image->rxAddressLsb[i]);
+	
+	// Data pipes
+	RadioUpdateRegister(EN_RXADDR, image->enabledPipes);
+	RadioUpdateRegister(EN_AA, image->autoAck);
+	for (uint8_t i = 0; i < 6; i++)
+		RadioUpdateRegister(RX_PW_P0 + i, 0b00111111 & image->payloadWidth[i]);
+	
+	// FEATURE must enable dynamic payload before DYNPD takes effect
+	RadioUpdateRegister(FEATURE, image->feature);
+	RadioUpdateRegister(DYNPD, image->dynamicPayload);
+	
+	RadioUpdateRegister(SETUP_RETR, image->retransmission);
+	RadioUpdateRegister(RF_SETUP, image->rfSetup);
+	RadioUpdateRegister(RF_CH, 0b01111111 & image->channel);
+	
+	// Keep power and role bits
+	uint8_t config = RadioReadShadow(CONFIG);
+	config = (config & ((1<<PWR_UP) | (1<<PRIM_RX))) | (image->config & ~((1<<PWR_UP) | (1<<PRIM_RX)));
+	RadioUpdateRegister(CONFIG, config);
+}
+
+// Same as RadioCommitConfig(), for images kept in flash
+// USAGE: const RadioConfigImage profile PROGMEM = { ... }; RadioCommitConfig_P(&profile);
+void RadioCommitConfig_P(const RadioConfigImage* image)
+{
+	RadioConfigImage ramImage;
+	memcpy_P(&ramImage, image, sizeof(RadioConfigImage));
+	RadioCommitConfig(&ramImage);
+}
+
 // Clears TX(transmitter) FIFO
 // The device can store 3 different payloads using the FirstInFirstOut(FIFO) principle 
 void RadioClearTX(void)
 {
 	CSN_LOW;
-	SpiShift(FLUSH_TX);
+	LastStatus = SpiShift(FLUSH_TX);
 	CSN_HIGH;	
+	
+	// ACK payloads are gone too
+	AckLoaded = 0;
+	AckLoadedCount = 0;
 }
 
 // Clears RX(receiver) FIFO
 void RadioClearRX(void)
 {
 	CSN_LOW;
-	SpiShift(FLUSH_RX);
+	LastStatus = SpiShift(FLUSH_RX);
 	CSN_HIGH;
 }
 
@@ -193,7 +598,7 @@ void RadioClearRX(void)
 void RadioConfigureInterrupts(void)
 {
 	// Get the current config so we can modify it
-	uint8_t config = RadioReadRegisterSingle(CONFIG);
+	uint8_t config = RadioReadShadow(CONFIG);
 
 	// RADIO_CONFIG is defined based on whether the user wants to enable interrupts or not
 	#if USE_IRQ == 0
@@ -211,7 +616,7 @@ void RadioConfigureInterrupts(void)
 	#endif
 	
 	// Save it to the device
-	RadioWriteRegisterSingle(CONFIG, config);
+	RadioUpdateRegister(CONFIG, config);
 }
 
 // Sets the transmitter address 
@@ -240,7 +645,7 @@ void RadioSetReceiverAddress(uint8_t dataPipe, const char* address)
 		dataPipe = 5;
 		
 	// TODO: address width setting
-	RadioWriteRegisterSingle(SETUP_AW, 0x03);
+	RadioUpdateRegister(SETUP_AW, 0x03);
 	
 	// RX_ADDR_PX is the registry we need to write the address to.
 	// RX_ADDR_P0 is 0x0A, RX_ADDR_P1 is 0x0B
@@ -268,14 +673,14 @@ void RadioSetReceiverAddress(uint8_t dataPipe, const char* address)
 // Checks the RX_DR flag status(used in pooling mode)
 uint8_t IsReceivedDataReady(void)
 {
-	uint8_t status = RadioReadRegisterSingle(STATUS);
+	uint8_t status = RadioNop();
 	return (status & (1<<RX_DR));
 }
 
 // Checks the TX_DS flag status, which indicates if transmission was successful
 uint8_t IsDataSentSuccessful(void)
 {
-	uint8_t status = RadioReadRegisterSingle(STATUS);
+	uint8_t status = RadioNop();
 	return (status & (1<<TX_DS));
 }
 
@@ -284,13 +689,13 @@ uint8_t IsDataSentSuccessful(void)
 void RadioEnableCRC(void)
 {
 	// Get the current config so we can modify it
-	uint8_t config = RadioReadRegisterSingle(CONFIG);
+	uint8_t config = RadioReadShadow(CONFIG);
 	
 	// Enable CRC
 	config |= (1<<EN_CRC);
 	
 	// Save it to the device
-	RadioWriteRegisterSingle(CONFIG, config);
+	RadioUpdateRegister(CONFIG, config);
 }
 
 // Sets the CRC length
@@ -301,14 +706,15 @@ void RadioSetCRCLength(uint8_t crcLength)
 		return;
 		
 	// Get the current config so we can modify it
-	uint8_t config = RadioReadRegisterSingle(CONFIG);
+	uint8_t config = RadioReadShadow(CONFIG);
 	
 	// For 1 byte length:  CRCO byte should be 0
 	// For 2 bytes length: CRCO byte should be 1
+	config &= ~(1<<CRCO);
 	config |= ((crcLength - 1) << CRCO);
 	
 	// Save data to the device
-	RadioWriteRegisterSingle(CONFIG, config);
+	RadioUpdateRegister(CONFIG, config);
 }
 
 // Powers up the radio
@@ -319,20 +725,47 @@ void RadioPowerUp(void)
 		return;
 	
 	// Get the current config so we can modify it
-	uint8_t config = RadioReadRegisterSingle(CONFIG);
+	uint8_t config = RadioReadShadow(CONFIG);
 	
 	// Set PWR_UP and CE to enter Standby-I
 	config |= (1<<PWR_UP);
 	CE_LOW;
 	
 	// Write this config to the device
-	RadioWriteRegisterSingle(CONFIG, config);
+	RadioUpdateRegister(CONFIG, config);
+	
+	// Device needs 1.5ms to power up, then it's in Standby-I
+	RadioSettle(1500, STANDBY_1);
+}
+
+// Returns 0 while the device is getting to another state (RADIO_NONBLOCKING only)
+uint8_t RadioIsReady(void)
+{
+	return State != SETTLING;
+}
+
+// Finishes the transition once the device had time to settle, see RadioSchedule()
+static void RadioSettled(void)
+{
+	if ((int16_t)(RADIO_TICKS() - SettleDeadline) < 0)
+		return;
 	
-	// Device needs 1.5ms to power up
-	_delay_us(1500);
+	State = TargetState;
 	
-	// Set appropriate state
-	State = STANDBY_1;
+	if (State == POWER_DOWN)
+	{
+		RadioStartUp();
+	}
+	else if (State == STANDBY_1)
+	{
+		// Send whatever has been queued meanwhile
+		RadioQueueKick();
+	}
+	else if (State == RX_MODE)
+	{
+		// ACK payloads queued meanwhile
+		RadioLoadAckPayloads();
+	}
 }
 
 // Powers down the device
@@ -343,7 +776,7 @@ void RadioPowerDown(void)
 		return;
 	
 	// Get the current config so we can modify it
-	uint8_t config = RadioReadRegisterSingle(CONFIG);
+	uint8_t config = RadioReadShadow(CONFIG);
 	
 	// Clearing PWR_UP bit will make the device enter PowerDown mode (see data sheet)
 	config &= ~(1<<PWR_UP);
@@ -352,7 +785,7 @@ void RadioPowerDown(void)
 	CE_LOW;
 	
 	// Save this config to the device
-	RadioWriteRegisterSingle(CONFIG, config);
+	RadioUpdateRegister(CONFIG, config);
 	
 	// Set appropriate state
 	State = POWER_DOWN;
@@ -370,13 +803,13 @@ void RadioSetRoleTransmitter(void)
 		return;
 		
 	// Get the current config so we can modify it
-	uint8_t config = RadioReadRegisterSingle(CONFIG);
+	uint8_t config = RadioReadShadow(CONFIG);
 	
 	// Clear PRIM_RX to set transmitter mode
 	config &= ~(1<<PRIM_RX);
 	
 	// Save this config to the device
-	RadioWriteRegisterSingle(CONFIG, config);
+	RadioUpdateRegister(CONFIG, config);
 		
 	// Set appropriate role
 	Role = ROLE_TRANSMITTER;
@@ -390,13 +823,13 @@ void RadioSetRoleReceiver(void)
 		return;
 	
 	// Get the current config so we can modify it
-	uint8_t config = RadioReadRegisterSingle(CONFIG);
+	uint8_t config = RadioReadShadow(CONFIG);
 	
 	// Set PRIM_RX to set transmitter mode
 	config |= (1<<PRIM_RX);
 	
 	// Save this config to the device
-	RadioWriteRegisterSingle(CONFIG, config);
+	RadioUpdateRegister(CONFIG, config);
 	
 	// Set appropriate role
 	Role = ROLE_RECEIVER;
@@ -419,18 +852,27 @@ void RadioEnterTxMode(void)
 	if (State == POWER_DOWN)
 		RadioPowerUp();
 	
-	// Set appropriate state
-	State = STANDBY_1;
+	// Set appropriate state, or the one to get to if the device is still settling
+	if (State == SETTLING)
+		TargetState = STANDBY_1;
+	else
+		State = STANDBY_1;
 	
 	TransmissionInProgress = 0;
 	ReceivedDataReady = 0;
+	
+	// Send whatever has been queued meanwhile
+	RadioQueueKick();
 }
 
 // Switches into receiver mode
 void RadioEnterRxMode(void)
 {
 	// If the device already is in RX mode or there is a transmission on air, don't do anything
-	if(State == RX_MODE || TransmissionInProgress == 1)
+	if(State == RX_MODE || State == STANDBY_2 || TransmissionInProgress == 1)
+		return;
+	
+	if (State == SETTLING && TargetState == RX_MODE)
 		return;
 	
 	RadioSetRoleReceiver();
@@ -446,21 +888,21 @@ void RadioEnterRxMode(void)
 	CE_HIGH;
 	
 	// Delay required by the device
-	_delay_us(130);
-	
-	// Set appropriate state
-	State = RX_MODE;
+	RadioSettle(130, RX_MODE);
 	
 	// Set initial values
 	TransmissionInProgress = 0;
 	ReceivedDataReady = 0;
+	
+	// ACK payloads queued meanwhile
+	RadioLoadAckPayloads();
 }
 
 // Sets the radio channel (radio frequency)
 void RadioSetChannel(uint8_t channel)
 {
 	// First bit in RF_CH must always be 0
-	RadioWriteRegisterSingle(RF_CH, 0b01111111 & channel);
+	RadioUpdateRegister(RF_CH, 0b01111111 & channel);
 }
 
 // Enables data pipe
@@ -471,13 +913,13 @@ void RadioEnableDataPipe(uint8_t dataPipe)
 		dataPipe = 5;
 	
 	// Get the current value so we can modify it
-	uint8_t en_rxaddr = RadioReadRegisterSingle(EN_RXADDR);
+	uint8_t en_rxaddr = RadioReadShadow(EN_RXADDR);
 	
 	// Write one to enable this data pipe
 	en_rxaddr |= (1 << dataPipe);
 	
 	// Save the value to the device
-	RadioWriteRegisterSingle(EN_RXADDR, en_rxaddr);
+	RadioUpdateRegister(EN_RXADDR, en_rxaddr);
 }
 
 // Disables data pipe
@@ -488,13 +930,13 @@ void RadioDisableDataPipe(uint8_t dataPipe)
 		dataPipe = 5;
 	
 	// Get the current value so we can modify it
-	uint8_t en_rxaddr = RadioReadRegisterSingle(EN_RXADDR);
+	uint8_t en_rxaddr = RadioReadShadow(EN_RXADDR);
 	
 	// Clear the bit to enable this data pipe
 	en_rxaddr &= ~(1 << dataPipe);
 	
 	// Save the value to the device
-	RadioWriteRegisterSingle(EN_RXADDR, en_rxaddr);
+	RadioUpdateRegister(EN_RXADDR, en_rxaddr);
 }
 
 // Enables auto ACK on the given data pipe
@@ -505,13 +947,13 @@ void RadioEnableAutoAck(uint8_t dataPipe)
 		dataPipe = 5;
 		
 	// Get the current value so we can modify it
-	uint8_t en_aa = RadioReadRegisterSingle(EN_AA);
+	uint8_t en_aa = RadioReadShadow(EN_AA);
 	
 	// Write one to enable auto ACK on this data pipe
 	en_aa|= (1 << dataPipe);
 	
 	// Save the value to the device
-	RadioWriteRegisterSingle(EN_AA, en_aa);
+	RadioUpdateRegister(EN_AA, en_aa);
 }
 
 // Disables auto ACK
@@ -522,13 +964,13 @@ void RadioDisableAck(uint8_t dataPipe)
 		dataPipe = 5;
 	
 	// Get the current value so we can modify it
-	uint8_t en_aa = RadioReadRegisterSingle(EN_AA);
+	uint8_t en_aa = RadioReadShadow(EN_AA);
 	
 	// Clear the bit to disable auto ACK on this data pipe
 	en_aa &= ~(1 << dataPipe);
 	
 	// Save the value to the device
-	RadioWriteRegisterSingle(EN_AA, en_aa);
+	RadioUpdateRegister(EN_AA, en_aa);
 }
 
 // Complex data pipe configuration
@@ -551,20 +993,25 @@ void RadioSetStaticPayloadWidth(uint8_t dataPipe, uint8_t width)
 	// Make sure we got a valid data pipe number
 	if(dataPipe > 5)
 		dataPipe = 5;
-	// Simple trick: RX_PW_P0 address is 11, if the user enters data pipe number X, 
-	//				 X+11 will make a valid registry address
+	
+	if (width > MAXIMUM_PAYLOAD_SIZE)
+		width = MAXIMUM_PAYLOAD_SIZE;
+	
+	// Simple trick: RX_PW_P0 address is 0x11, if the user enters data pipe number X, 
+	//				 X+0x11 will make a valid registry address
 	// See device data sheet, section 9.1
-	dataPipe += 0x11;
+	RadioUpdateRegister(RX_PW_P0 + dataPipe, width);
 	
-	// Two MSB must always be 0
-	RadioWriteRegisterSingle(dataPipe, 0b00111111 & width);
+	// Static width is only used with dynamic width off
+	if (RadioReadShadow(DYNPD) & (1 << dataPipe))
+		RadioSetDynamicPayload(dataPipe, 0);
 }
 
 // Configures retransmission parameters
 // Time is one of ARD_US_XXXX, and ammount one of ARC_XX
 void RadioConfigRetransmission(uint8_t time, uint8_t ammount)
 {
-	RadioWriteRegisterSingle(SETUP_RETR, time | ammount);
+	RadioUpdateRegister(SETUP_RETR, time | ammount);
 }
 
 // Sets the transmission speed
@@ -573,13 +1020,13 @@ void RadioSetSpeed(uint8_t speed)
 {
 	// TODO: fix
 	// Get the current setup so we can modify it
-	uint8_t rfSetup = RadioReadRegisterSingle(RF_SETUP);
+	uint8_t rfSetup = RadioReadShadow(RF_SETUP);
 	
 	// Use mask to write bits correctly
 	rfSetup = ((rfSetup & SPEED_MASK) | speed);
 	
 	// Write the value to the device
-	RadioWriteRegisterSingle(RF_SETUP, rfSetup);
+	RadioUpdateRegister(RF_SETUP, rfSetup);
 }
 
 // Sets the radio power
@@ -588,13 +1035,13 @@ void RadioSetPower(uint8_t power)
 {
 	// TODO: fix
 	// Get the current setup so we can modify it
-	uint8_t rfSetup = RadioReadRegisterSingle(RF_SETUP);
+	uint8_t rfSetup = RadioReadShadow(RF_SETUP);
 	
 	// Use mask to write bits correctly
 	rfSetup = ((rfSetup & POWER_MASK) | power);
 	
 	// Write the value to the device
-	RadioWriteRegisterSingle(RF_SETUP, rfSetup);
+	RadioUpdateRegister(RF_SETUP, rfSetup);
 }
 
 // Sets the dynamic payload on or off
@@ -605,21 +1052,21 @@ void RadioSetDynamicPayload(uint8_t dataPipe, uint8_t onOff)
 		dataPipe = 5;
 	
 	// Get the current config so we can modify it
-	uint8_t dynpd = RadioReadRegisterSingle(DYNPD);
+	uint8_t dynpd = RadioReadShadow(DYNPD);
 	
 	// Write one to enable; zero to disable dynamic payload with
 	if(onOff)
 		dynpd |= (1 << dataPipe);
 	else
-		dynpd &= (1 << dataPipe);
+		dynpd &= ~(1 << dataPipe);
 	
 	// Write value to the device
-	RadioWriteRegisterSingle(DYNPD, dynpd);
+	RadioUpdateRegister(DYNPD, dynpd);
 	
 	// To use dynamic payload length it must be enabled in feature registry
 	
 	// Get current FEATURE registry value so we can modify it
-	uint8_t feature = RadioReadRegisterSingle(FEATURE);
+	uint8_t feature = RadioReadShadow(FEATURE);
 	
 	// If function was called to enable dynamic width, enable it in feature registry
 	if (onOff)
@@ -630,52 +1077,114 @@ void RadioSetDynamicPayload(uint8_t dataPipe, uint8_t onOff)
 		feature &= ~(1<<EN_DPL);
 		
 	// Write the value to the device
-	RadioWriteRegisterSingle(FEATURE, feature);
+	RadioUpdateRegister(FEATURE, feature);
 }
 
 // Loads device with data ready to transmit
-void RadioLoadPayload(uint8_t* data, uint8_t length)
+void RadioLoadPayload(const uint8_t* data, uint8_t length)
 {	
 	CSN_LOW;
 	
 	// To write data to TX FIFO you need to start transmission with W_TX_PAYLOAD
-	SpiShift(W_TX_PAYLOAD);
+	LastStatus = SpiShift(W_TX_PAYLOAD);
 	
 	// Write all the data
-	for(uint8_t i = 0; i < length; i++)
-		SpiShift(data[i]++);
+	SpiWrite(data, length);
 	
 	CSN_HIGH;
 }
 
-// Sends data
-// NOTE: Make sure the device is in TX mode before calling this method
-void RadioSend(uint8_t* data)
+// Same as RadioLoadPayload(), data is read straight from program memory
+void RadioLoadPayload_P(const uint8_t* data, uint8_t length)
+{	
+	CSN_LOW;
+	LastStatus = SpiShift(W_TX_PAYLOAD);
+	SpiWrite_P(data, length);
+	CSN_HIGH;
+}
+
+// RadioSendPayload() options
+#define SEND_FLASH	0x01	// Data is in program memory
+#define SEND_NO_ACK	0x02	// Receiver must not acknowledge the packet
+
+#if SPI_ASYNC != 0
+// Reads RX FIFO head in the background, complete() is called from SPI interrupt when it's done
+// Length should come from R_RX_PL_WID (dynamic payload) or RX_PW_Px (static payload)
+void RadioReadPayloadAsync(SpiJob* job, uint8_t* buffer, uint8_t length, void (*complete)(SpiJob*))
 {
+	job->command = R_RX_PAYLOAD;
+	job->tx = NULL;
+	job->rx = buffer;
+	job->length = length;
+	job->complete = complete;
+	SpiSubmit(job);
+}
+#endif
+
+// Uploads the payload and starts transmission, options are SEND_XXX flags
+// Returns 0 if the payload is refused
+static uint8_t RadioSendPayload(const uint8_t* data, uint8_t length, uint8_t options)
+{
+	uint8_t command = W_TX_PAYLOAD;
+	
 	// Wait for previous transmission to end
+	if (TransmissionInProgress == 1)
+		return 0;
+	
 	// Also cannot send data when in RX mode
+	// RadioSendResult() mustn't keep reporting the previous payload
 	// NOTE: before calling make sure that RadioEnterTxMode() had been called before
-	if (TransmissionInProgress == 1 || State != STANDBY_1)
-		return;
+	if (State != STANDBY_1 || length == 0)
+	{
+		SendResult = SEND_FAILED;
+		return 0;
+	}
 	
 	// If transmitter mode is already set this won't change anything, 
 	// but if receiver mode is set this will set proper mode
 	RadioSetRoleTransmitter();
 	
-	// Get the length of the data 
-	uint8_t dataLength = strlen((char*)data);
-	
 	// Make sure it does not exceed the limit
-	if (dataLength > MAXIMUM_PAYLOAD_SIZE) 
-		dataLength = MAXIMUM_PAYLOAD_SIZE;
+	if (length > MAXIMUM_PAYLOAD_SIZE) 
+		length = MAXIMUM_PAYLOAD_SIZE;
+	
+	// W_TX_PAYLOAD_NOACK is ignored unless EN_DYN_ACK is set, no SPI traffic once it is
+	if (options & SEND_NO_ACK)
+	{
+		RadioUpdateRegister(FEATURE, RadioReadShadow(FEATURE) | (1<<EN_DYN_ACK));
+		command = W_TX_PAYLOAD_NOACK;
+	}
 
 	// Presuming device is in Standby-I
-	RadioLoadPayload(data, dataLength);
+	#if SPI_ASYNC != 0
+	
+	// Upload in the background, PayloadUploaded() starts transmission when it's done
+	// The caller's buffer is free once this returns, so the payload needs a copy
+	if (options & SEND_FLASH)
+		memcpy_P(TXBuffer, data, length);
+	else
+		memcpy(TXBuffer, data, length);
+	PayloadJob.command = command;
+	PayloadJob.tx = TXBuffer;
+	PayloadJob.rx = NULL;
+	PayloadJob.length = length;
+	PayloadJob.complete = PayloadUploaded;
+	SpiSubmit(&PayloadJob);
+	
+	#else
+	
+	CSN_LOW;
+	LastStatus = SpiShift(command);
+	if (options & SEND_FLASH)
+		SpiWrite_P(data, length);
+	else
+		SpiWrite(data, length);
+	CSN_HIGH;
 	
 	// 10s high pulse on CE starts transmission
-	CE_HIGH;
-	_delay_us(10);
-	CE_LOW;	
+	RadioPulseCE();
+	
+	#endif
 	
 	// TX settings delay
 	// NOTE: can be omitted
@@ -683,59 +1192,559 @@ void RadioSend(uint8_t* data)
 	
 	// Indicate operation
 	TransmissionInProgress = 1;
+	SendResult = SEND_PENDING;
 	State = TX_MODE;
+	
+	return 1;
+}
+
+// Sends a NUL-terminated string, up to 32 characters
+// Returns 0 if the device is busy or not in TX mode, RadioSendResult() is SEND_PENDING only when it returns 1
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t RadioSend(uint8_t* data)
+{
+	// Get the length of the data, no need to look past the limit
+	uint8_t dataLength = 0;
+	while (dataLength < MAXIMUM_PAYLOAD_SIZE && data[dataLength])
+		dataLength++;
+	
+	return RadioSendPayload(data, dataLength, 0);
+}
+
+// Sends length bytes (up to 32) of any data, the buffer is not modified
+// Returns 0 if the device is busy or not in TX mode, like RadioSend()
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t RadioSendBuffer(const uint8_t* data, uint8_t length)
+{
+	return RadioSendPayload(data, length, 0);
+}
+
+// Same as RadioSendBuffer(), data is in program memory
+uint8_t RadioSendBuffer_P(const uint8_t* data, uint8_t length)
+{
+	return RadioSendPayload(data, length, SEND_FLASH);
+}
+
+// Sends length bytes (up to 32) without asking for an ACK, so without retransmissions either
+// TX_DS comes as soon as the packet is on air, whether anyone received it or not
+// Meant for frequent data where a fresh sample is worth more than a lost one
+uint8_t RadioSendBufferNoAck(const uint8_t* data, uint8_t length)
+{
+	return RadioSendPayload(data, length, SEND_NO_ACK);
+}
+
+// Returns SEND_PENDING until RADIO_EVENT() handles the end of the last RadioSend*(),
+// then SEND_DONE or SEND_FAILED if nobody acknowledged it or the device wasn't ready for it
+uint8_t RadioSendResult(void)
+{
+	return SendResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// TX queue
+// Messages are kept in RAM until there's a free TX FIFO slot. The queue feeds the stream below,
+// so it's drained from RADIO_EVENT() on every TX_DS without waiting for the whole transmission to end.
+//////////////////////////////////////////////////////////////////////////
+
+// Stream source handing out queued messages
+static uint8_t RadioQueueSource(uint8_t* buffer)
+{
+	if (QueueCount == 0)
+		return 0;
+	
+	QueuedMessage* message = &TxQueue[QueueHead];
+	uint8_t length = message->length;
+	memcpy(buffer, message->data, length);
+	
+	if (++QueueHead == TX_QUEUE_SIZE)
+		QueueHead = 0;
+	QueueCount--;
+	
+	return length;
+}
+
+// Starts draining the queue if the device is free to send
+static void RadioQueueKick(void)
+{
+	if (QueueCount == 0)
+		return;
+	
+	if (State == STANDBY_1 && TransmissionInProgress == 0)
+	{
+		RadioStreamBegin(RadioQueueSource);
+	}
+	else if (State == STANDBY_2 && (StreamSource == NULL || StreamSource == RadioQueueSource))
+	{
+		// Queue's stream is still sending its last payloads
+		StreamSource = RadioQueueSource;
+		RadioStreamRefill();
+	}
+}
+
+// Queues a message, it's sent as soon as the device has a free TX FIFO slot
+// Returns QUEUE_OK, or QUEUE_FULL if the message has not been taken
+// NOTE: Messages queued in RX mode wait for RadioEnterTxMode()
+uint8_t RadioEnqueue(const uint8_t* data, uint8_t length)
+{
+	if (QueueCount == TX_QUEUE_SIZE)
+		return QUEUE_FULL;
+	
+	if (length > MAXIMUM_PAYLOAD_SIZE)
+		length = MAXIMUM_PAYLOAD_SIZE;
+	
+	uint8_t tail = QueueHead + QueueCount;
+	if (tail >= TX_QUEUE_SIZE)
+		tail -= TX_QUEUE_SIZE;
+	
+	TxQueue[tail].length = length;
+	memcpy(TxQueue[tail].data, data, length);
+	
+	if (++QueueCount > QueueHighWatermark)
+		QueueHighWatermark = QueueCount;
+	
+	RadioQueueKick();
+	
+	return QUEUE_OK;
+}
+
+// Number of messages waiting in RAM (not counting the ones already in TX FIFO)
+uint8_t RadioQueueCount(void)
+{
+	return QueueCount;
+}
+
+// The most messages the queue has ever held, to size TX_QUEUE_SIZE
+uint8_t RadioQueueHighWatermark(void)
+{
+	return QueueHighWatermark;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Streaming (Standby-II)
+// CE stays high, so the device sends whatever is in TX FIFO back to back and waits in Standby-II
+// when it runs empty. All three FIFO slots are kept filled: every TX_DS frees at least one of them
+// and RADIO_EVENT() refills it straight away, so the next packet is ready before the current one ends.
+//////////////////////////////////////////////////////////////////////////
+
+// Uploads payloads from the source until TX FIFO is full or the source runs dry
+// status should be fresh - TX_FULL is the only thing looked at
+static void RadioStreamFill(uint8_t status)
+{
+	while (StreamSource && !(status & (1<<TX_FULL)))
+	{
+		uint8_t length = StreamSource(StreamBuffer);
+		if (length == 0)
+			break;
+		
+		// Source is done for good, same as RadioStreamEnd()
+		if (length == STREAM_END)
+		{
+			StreamSource = NULL;
+			break;
+		}
+		
+		if (length > MAXIMUM_PAYLOAD_SIZE)
+			length = MAXIMUM_PAYLOAD_SIZE;
+		
+		RadioLoadPayload(StreamBuffer, length);
+		
+		// Status clocked out by W_TX_PAYLOAD is from before the write
+		status = RadioNop();
+	}
+}
+
+// Number of payloads in TX FIFO, CE must be low
+// FIFO_STATUS only tells empty and full apart, a 1-byte probe tells 1 from 2 - flush TX FIFO afterwards
+static uint8_t RadioTxFifoCount(void)
+{
+	uint8_t fifo = RadioReadRegisterSingle(FIFO_STATUS);
+	uint8_t probe = 0;
+	
+	if (fifo & (1<<TX_EMPTY))
+		return 0;
+	
+	if (fifo & (1<<FIFO_FULL))
+		return 3;
+	
+	RadioLoadPayload(&probe, 1);
+	return (RadioNop() & (1<<TX_FULL)) ? 2 : 1;
 }
 
-uint8_t RadioReadData(void)
+// Goes back to Standby-I once the last payload has left the device
+static void RadioStreamFinish(void)
+{
+	// Stream started by the queue ends on its own when the queue is drained
+	if (StreamSource == RadioQueueSource && QueueCount == 0)
+		StreamSource = NULL;
+	
+	if (StreamSource || !(RadioReadRegisterSingle(FIFO_STATUS) & (1<<TX_EMPTY)))
+		return;
+	
+	CE_LOW;
+	State = STANDBY_1;
+	
+	RadioQueueKick();
+}
+
+// Starts streaming payloads supplied by source, returns 0 if the device is busy
+// source fills the buffer (up to 32 bytes) and returns its length, 0 if there is nothing to send right now
+// or STREAM_END when it's done
+// NOTE: Make sure the device is in TX mode before calling this method
+uint8_t RadioStreamBegin(uint8_t (*source)(uint8_t* buffer))
+{
+	if (TransmissionInProgress == 1 || State != STANDBY_1)
+		return 0;
+	
+	RadioSetRoleTransmitter();
+	
+	StreamSource = source;
+	StreamDropped = 0;
+	State = STANDBY_2;
+	
+	// Fill the FIFO first, so the packets go out back to back from the start
+	RadioStreamFill(RadioNop());
+	CE_HIGH;
+	
+	// Source might have had nothing at all
+	if (StreamSource == NULL)
+		RadioStreamFinish();
+	
+	return 1;
+}
+
+// Should be called when the source gets new data after it returned 0
+// (TX FIFO may have run empty meanwhile and no TX_DS will come to pick the data up)
+void RadioStreamRefill(void)
+{
+	if (State != STANDBY_2)
+		return;
+	
+	RadioStreamFill(RadioNop());
+	
+	if (StreamSource == NULL)
+		RadioStreamFinish();
+}
+
+// Stops asking the source for data, the device goes back to Standby-I after sending what it already has
+void RadioStreamEnd(void)
+{
+	if (State != STANDBY_2)
+		return;
+	
+	StreamSource = NULL;
+	RadioStreamFinish();
+}
+
+// Payloads the source handed over that were flushed after MAX_RT since RadioStreamBegin(),
+// the one nobody acknowledged and the ones behind it in TX FIFO
+uint16_t RadioStreamDropped(void)
+{
+	return StreamDropped;
+}
+
+// Payload width of a pipe with static width, 0 for pipes with dynamic width
+static uint8_t RadioStaticWidth(uint8_t dataPipe)
+{
+	if ((RadioReadShadow(FEATURE) & (1<<EN_DPL)) && (RadioReadShadow(DYNPD) & (1 << dataPipe)))
+		return 0;
+	
+	return RadioReadShadow(RX_PW_P0 + dataPipe);
+}
+
+// Set while LastStatus tells what's at RX FIFO head, RADIO_EVENT() reads it just before draining the FIFO
+static uint8_t StatusFresh = 0;
+
+// Reads RX FIFO head into buffer (MAXIMUM_PAYLOAD_SIZE + 1 bytes), the remaining payloads stay in the device
+// Returns the length and saves the data pipe the payload came from, RX_FIFO_EMPTY if there was nothing to read
+static uint8_t RadioReadPayload(uint8_t* buffer, uint8_t* pipe)
 {
-	// Prepare for reading data
-	uint8_t fifoStatus;
 	uint8_t dataLength;
-	do
+	uint8_t headPipe = StatusFresh ? RX_PIPE(LastStatus) : RX_FIFO_EMPTY;
+	
+	StatusFresh = 0;
+	
+	// Width of a static pipe is known, R_RX_PL_WID can be skipped
+	// Without fresh STATUS the pipe isn't known until R_RX_PAYLOAD, only fine if no pipe uses dynamic width
+	uint8_t dynamicPipes = (RadioReadShadow(FEATURE) & (1<<EN_DPL)) ? RadioReadShadow(DYNPD) : 0;
+	if ((headPipe <= DATA_PIPE_5 && RadioStaticWidth(headPipe)) ||
+		(headPipe == RX_FIFO_EMPTY && (dynamicPipes & RadioReadShadow(EN_RXADDR)) == 0))
 	{
 		CSN_LOW;
+		LastStatus = SpiShift(R_RX_PAYLOAD);
+		*pipe = RX_PIPE(LastStatus);
 		
-		// If using dynamic width
-		SpiShift(R_RX_PL_WID);
-		dataLength = SpiShift(NOP);
+		dataLength = *pipe <= DATA_PIPE_5 ? RadioStaticWidth(*pipe) : 0;
+		if (dataLength > MAXIMUM_PAYLOAD_SIZE)
+			dataLength = 0;
+		
+		SpiRead(buffer, dataLength, NOP);
+		CSN_HIGH;
+		
+		buffer[dataLength] = '\0';
+		return dataLength;
+	}
+	
+	CSN_LOW;
+	
+	// STATUS clocked out with the command tells where the head comes from
+	LastStatus = SpiShift(R_RX_PL_WID);
+	*pipe = RX_PIPE(LastStatus);
+	
+	if (*pipe > DATA_PIPE_5)
+	{
 		CSN_HIGH;
+		return 0;
+	}
+	
+	// If using dynamic width
+	dataLength = SpiShift(NOP);
+	CSN_HIGH;
 
-		// If data's too big for the buffer discard it and clear the device buffer
-		if( dataLength > MAXIMUM_PAYLOAD_SIZE)
+	// Width out of range means the payload is corrupted, discard it and clear the device buffer
+	if (dataLength == 0 || dataLength > MAXIMUM_PAYLOAD_SIZE)
+	{
+		// Debugging
+		uart_puts("data's too big. Quitting");
+		
+		RadioClearRX();
+		*pipe = RX_FIFO_EMPTY;
+		return 0;
+	}
+	
+	// Read payload from the device, it leaves RX FIFO when CSN goes high
+	CSN_LOW;
+	LastStatus = SpiShift(R_RX_PAYLOAD);
+	SpiRead(buffer, dataLength, NOP);
+	CSN_HIGH;
+	
+	// Add the null character at the end (useful for transmitting strings)
+	buffer[dataLength] = '\0';
+	
+	return dataLength;
+}
+
+// Reads RX FIFO head into RXBuffer, the remaining payloads stay in the device
+// Returns the length and saves the data pipe the payload came from, RX_FIFO_EMPTY if there was nothing to read
+uint8_t RadioReadData(uint8_t* pipe)
+{
+	return RadioReadPayload(RXBuffer, pipe);
+}
+
+volatile uint8_t Irq = 0;
+
+//////////////////////////////////////////////////////////////////////////
+// RX slots
+// Payloads are read from the device straight into a slot and lent to the application, which
+// releases them when it's done. Slots are handed out oldest first. When all of them are taken
+// payloads wait in RX FIFO, and once that's full too the device stops acknowledging, so
+// transmitters retry instead of the data being overwritten.
+//////////////////////////////////////////////////////////////////////////
+#define SLOT_FREE	0
+#define SLOT_FILLED	1
+#define SLOT_LENT	2
+
+static RadioRxSlot RxSlots[RX_SLOT_COUNT];
+static uint8_t SlotState[RX_SLOT_COUNT];
+
+// Oldest slot in use and number of slots in use (filled or lent) from there on
+static uint8_t SlotHead = 0;
+static uint8_t SlotCount = 0;
+
+// Set when RX FIFO could not be emptied for lack of slots
+static uint8_t SlotsExhausted = 0;
+
+// Reads RX FIFO head into the next free slot, NULL if there is no slot or no payload
+static RadioRxSlot* RadioFillSlot(void)
+{
+	if (SlotCount == RX_SLOT_COUNT)
+	{
+		SlotsExhausted = 1;
+		return NULL;
+	}
+	
+	uint8_t index = SlotHead + SlotCount;
+	if (index >= RX_SLOT_COUNT)
+		index -= RX_SLOT_COUNT;
+	
+	RadioRxSlot* slot = &RxSlots[index];
+	slot->length = RadioReadPayload(slot->data, &slot->pipe);
+	if (slot->length == 0)
+		return NULL;
+	
+	slot->timestamp = RADIO_TIMESTAMP();
+	SlotState[index] = SLOT_FILLED;
+	SlotCount++;
+	
+	return slot;
+}
+
+// Lends the oldest received payload to the application, NULL if there is none
+// The slot stays valid until RadioReleaseSlot()
+RadioRxSlot* RadioBorrowSlot(void)
+{
+	uint8_t index = SlotHead;
+	
+	for (uint8_t i = 0; i < SlotCount; i++)
+	{
+		if (SlotState[index] == SLOT_FILLED)
 		{
-			// Debugging
-			uart_puts("data's too big. Quitting");
-			
-			RadioClearRX();
-			return 0;
+			SlotState[index] = SLOT_LENT;
+			return &RxSlots[index];
+		}
+		
+		if (++index == RX_SLOT_COUNT)
+			index = 0;
+	}
+	
+	return NULL;
+}
+
+// Gives the slot back, slots may be released in any order
+void RadioReleaseSlot(RadioRxSlot* slot)
+{
+	SlotState[slot - RxSlots] = SLOT_FREE;
+	
+	// Only whole runs of released slots at the head can be reused
+	while (SlotCount && SlotState[SlotHead] == SLOT_FREE)
+	{
+		if (++SlotHead == RX_SLOT_COUNT)
+			SlotHead = 0;
+		SlotCount--;
+	}
+	
+	// Payloads left in the device raise no more interrupts, have RADIO_EVENT() pick them up
+	if (SlotsExhausted && SlotCount < RX_SLOT_COUNT)
+	{
+		SlotsExhausted = 0;
+		ReceivedDataReady = 1;
+		Irq = 1;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ACK payloads
+// Receiver attaches data to the ACKs it sends, so the transmitter gets a response without
+// either side switching roles. Payloads are queued per pipe and kept in RAM until the device
+// has room for them - it holds 3, and only one per pipe here so it's known which one went out:
+// the ACK payload of a pipe leaves with the ACK of the next new packet received on it.
+// On the transmitter ACK payloads arrive in RX FIFO (pipe 0) and are delivered like any other data.
+// NOTE: Requires dynamic payload width on the pipes used, on both sides
+//////////////////////////////////////////////////////////////////////////
+
+// Enables or disables ACK payloads (EN_ACK_PAY), on both transmitter and receiver
+void RadioSetAckPayload(uint8_t onOff)
+{
+	uint8_t feature = RadioReadShadow(FEATURE);
+	
+	if (onOff)
+		feature |= (1<<EN_ACK_PAY) | (1<<EN_DPL);
+	else
+		feature &= ~(1<<EN_ACK_PAY);
+	
+	RadioUpdateRegister(FEATURE, feature);
+}
+
+// Moves queued ACK payloads into the device, oldest first
+static void RadioLoadAckPayloads(void)
+{
+	// Written in RX mode only, in TX mode they would sit at TX FIFO head
+	// Payloads still in RX FIFO have been acknowledged already, loading one now would make it look
+	// like they took it
+	if (State != RX_MODE || AckDeferred)
+		return;
+	
+	uint8_t i = 0;
+	while (i < AckCount && AckLoadedCount < 3)
+	{
+		AckMessage* message = &AckQueue[i];
+		
+		// This pipe's ACK payload hasn't gone out yet, keep the order
+		if (AckLoaded & (1 << message->pipe))
+		{
+			i++;
+			continue;
 		}
 		
-		// Read payload from the device
 		CSN_LOW;
-		SpiShift(R_RX_PAYLOAD);
-		uint8_t i;
-		for(i = 0; i < dataLength; i++)
-			RXBuffer[i] = SpiShift(NOP);
+		LastStatus = SpiShift(W_ACK_PAYLOAD | message->pipe);
+		SpiWrite(message->data, message->length);
 		CSN_HIGH;
 		
-		// Add the null character at the end (useful for transmitting strings)
-		RXBuffer[i] = '\0';
+		AckLoaded |= (1 << message->pipe);
+		AckLoadedCount++;
 		
-		// Clear the device buffer
-		// TODO: triple buffering
-		RadioClearRX();
+		memmove(message, message + 1, (AckCount - i - 1) * sizeof(AckMessage));
+		AckCount--;
+	}
+}
+
+// Called for every new payload received, the ACK it got carried the pipe's ACK payload
+static void RadioAckPayloadSent(uint8_t dataPipe)
+{
+	if (!(AckLoaded & (1 << dataPipe)))
+		return;
+	
+	AckLoaded &= ~(1 << dataPipe);
+	AckLoadedCount--;
+}
+
+// Queues data to be sent with the next ACK on the pipe (receiver only)
+// Returns QUEUE_OK, or QUEUE_FULL if the payload has not been taken
+uint8_t RadioQueueAckPayload(uint8_t dataPipe, const uint8_t* data, uint8_t length)
+{
+	if (AckCount == ACK_QUEUE_SIZE)
+		return QUEUE_FULL;
+	
+	// Data validation
+	if (dataPipe > 5)
+		dataPipe = 5;
+	
+	if (length > MAXIMUM_PAYLOAD_SIZE)
+		length = MAXIMUM_PAYLOAD_SIZE;
+	
+	AckMessage* message = &AckQueue[AckCount++];
+	message->pipe = dataPipe;
+	message->length = length;
+	memcpy(message->data, data, length);
+	
+	RadioLoadAckPayloads();
+	
+	return QUEUE_OK;
+}
+
+// Same as RadioQueueAckPayload(), but replaces the pipe's payload still waiting in RAM (if any)
+// Meant for state that gets outdated, like acknowledgments
+uint8_t RadioUpdateAckPayload(uint8_t dataPipe, const uint8_t* data, uint8_t length)
+{
+	for (uint8_t i = 0; i < AckCount; i++)
+	{
+		AckMessage* message = &AckQueue[i];
+		if (message->pipe != dataPipe)
+			continue;
+		
+		if (length > MAXIMUM_PAYLOAD_SIZE)
+			length = MAXIMUM_PAYLOAD_SIZE;
 		
-		// TODO: There may be data in buffer that comes from different data pipes
-		fifoStatus = RadioReadRegisterSingle(FIFO_STATUS);
+		message->length = length;
+		memcpy(message->data, data, length);
+		return QUEUE_OK;
 	}
-	// Read until RX is empty
-	// TODO: triple buffering? or maybe another solution
-	while ((fifoStatus & (1<<RX_EMPTY)) == 0);
 	
-	return dataLength;
+	return RadioQueueAckPayload(dataPipe, data, length);
 }
 
-volatile uint8_t Irq = 0;
+// Returns 1 while the pipe has an ACK payload that hasn't gone out, in the device or waiting in RAM
+uint8_t RadioAckPayloadWaiting(uint8_t dataPipe)
+{
+	if (AckLoaded & (1 << dataPipe))
+		return 1;
+	
+	for (uint8_t i = 0; i < AckCount; i++)
+		if (AckQueue[i].pipe == dataPipe)
+			return 1;
+	
+	return 0;
+}
 
 // Main event function
 // Should be called as often as possible in program's main loop
@@ -746,6 +1755,15 @@ void RADIO_EVENT(void)
 	//uart_putint(status, 16);
 	//uart_putc('\n');
 	//_delay_ms(100);
+	
+	// Nothing to handle before the device gets where it's going
+	if (State == SETTLING)
+	{
+		RadioSettled();
+		if (State == SETTLING)
+			return;
+	}
+	
 #if USE_IRQ == 0
 	{
 #else
@@ -753,41 +1771,65 @@ void RADIO_EVENT(void)
 	{
 		Irq = 0;
 #endif
-		// Get the register to check for any events
-		uint8_t status = RadioReadRegisterSingle(STATUS);
+		// STATUS is clocked out with any command, NOP is the shortest one
+		uint8_t status = RadioNop();
 	
 		//uart_putint(status, 16);
 		//uart_putc('\n');
 		//_delay_ms(100);
+		
+		// Clear all the flags we are about to handle with one write
+		// Done up front, so an event happening meanwhile raises the IRQ again
+		if (status & IRQ_CLEAR_MASK)
+			RadioWriteRegisterSingle(STATUS, status & IRQ_CLEAR_MASK);
 	
 		// Check if sending data was successful
-		if (DATA_SEND_SUCCESS(status))
+		if (DATA_SEND_SUCCESS(status) && State == STANDBY_2)
 		{
-			// TOCO: ACK with payload handling, just clear the buffer for now
-			RadioClearRX();
-			
-			// Clear flag
-			status |= (1<<TX_DS);
-			RadioWriteRegisterSingle(STATUS, status);
-			
+			// One or more payloads are gone, the rest is still on its way
+			RadioStreamFill(status);
+			RadioStreamFinish();
+		}
+		else if (DATA_SEND_SUCCESS(status) && State == RX_MODE)
+		{
+			// Receiver has sent an ACK payload, RX FIFO handling below tells which pipe it was for
+		}
+		else if (DATA_SEND_SUCCESS(status))
+		{
+			// ACK payload that came with the ACK (if any) is in RX FIFO, read below
+			CE_LOW;
 			TransmissionInProgress = 0;
+			SendResult = SEND_DONE;
 			State = STANDBY_1;
 			uart_puts("Data sent successfully\n");
+			
+			RadioQueueKick();
 		}
 	
 		// Sending data failed
 		// TODO: handling this event
-		if (MAXIMUM_RETRANSMISSIONS_REACHED(status))
+		if (MAXIMUM_RETRANSMISSIONS_REACHED(status) && State == STANDBY_2)
 		{
-			// Clear IRQ flag
-			status |= (1<< MAX_RT);
-			RadioWriteRegisterSingle(STATUS, status);
-		
+			// Nobody listens, drop what's queued and carry on with fresh data
+			// CE low while counting, so the device doesn't pick up the probe
+			CE_LOW;
+			StreamDropped += RadioTxFifoCount();
+			RadioClearTX();
+			CE_HIGH;
+			RadioStreamRefill();
+			RadioStreamFinish();
+		}
+		else if (MAXIMUM_RETRANSMISSIONS_REACHED(status))
+		{
+			CE_LOW;
 			RadioClearTX();
 			TransmissionInProgress = 0;
+			SendResult = SEND_FAILED;
 			State = STANDBY_1;
 		
 			uart_puts("Max retransmissions\n");
+			
+			RadioQueueKick();
 		}
 	
 		// Continuously check if there is any data to be read from the device
@@ -801,15 +1843,32 @@ void RADIO_EVENT(void)
 			// Indicate we have received data
 			ReceivedDataReady = 0;
 		
-			// Clear flag
-			status |= (1<<RX_DR);
-			RadioWriteRegisterSingle(STATUS, status);
-		
-			uint8_t dataLength = RadioReadData();		
-		
-			// Tell listeners that we have received the data, however make sure that length is not 0
-			if(dataLength != 0 && ReceiverCallback) 
-				(*ReceiverCallback)(RXBuffer, dataLength);
+			// Move every payload in RX FIFO to a slot, not just the first one
+			RadioRxSlot* slot;
+			AckDeferred = 1;
+			StatusFresh = 1;
+			while ((slot = RadioFillSlot()) != NULL)
+			{
+				RadioAckPayloadSent(slot->pipe);
+				
+				// Pipe's own callback first, RX_P_NO tells where the payload came from
+				void (*callback)(uint8_t*, uint8_t, uint8_t) = PipeCallbacks[slot->pipe];
+				if (callback == NULL)
+					callback = ReceiverCallback;
+				
+				// Tell listeners that we have received the data, the slot is free again when it returns
+				// Without a callback the application takes slots with RadioBorrowSlot()
+				if(callback) 
+				{
+					SlotState[slot - RxSlots] = SLOT_LENT;
+					(*callback)(slot->data, slot->length, slot->pipe);
+					RadioReleaseSlot(slot);
+				}
+			}
+			
+			// Pipes whose ACK payloads went out can take the next ones
+			AckDeferred = 0;
+			RadioLoadAckPayloads();
 		}	
 	}
 }
@@ -8,6 +8,10 @@
 #ifndef NRF24_H_
 #define NRF24_H_
 
+#include <stdint.h>
+
+#include "NrfMemoryMap.h"
+
 //////////////////////////////////////////////////////////////////////////
 // COMPILE-TIME SETTINGS
 //////////////////////////////////////////////////////////////////////////
@@ -29,17 +33,114 @@
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #define USE_IRQ 1
 
+// Messages RadioEnqueue() can hold on top of the 3-level TX FIFO (33 bytes of RAM each)
+#ifndef TX_QUEUE_SIZE
+#define TX_QUEUE_SIZE 8
+#endif
+
+// ACK payloads RadioQueueAckPayload() can hold until the device has room for them
+#ifndef ACK_QUEUE_SIZE
+#define ACK_QUEUE_SIZE 3
+#endif
+
+// Received payloads the application can hold at once, see RadioBorrowSlot() (38 bytes of RAM each)
+#ifndef RX_SLOT_COUNT
+#define RX_SLOT_COUNT 4
+#endif
+
+// Time base of RadioRxSlot.timestamp, define to the application's clock (i.e. millis())
+#ifndef RADIO_TIMESTAMP
+#if defined(SIM_SPI) && SIM_SPI != 0
+#define RADIO_TIMESTAMP() NrfSimMicros()
+#else
+#define RADIO_TIMESTAMP() 0
+#endif
+#endif
+
+// != 0	- start up, power up and RX settling don't block, the device stays in SETTLING state until
+//		  RADIO_EVENT() sees the time has passed (see RadioIsReady()), CE is held until the end of a transmission
+// 0	- busy waits
+#ifndef RADIO_NONBLOCKING
+#define RADIO_NONBLOCKING 0
+#endif
+
+// Free-running 16-bit clock timing the settling (and LPL, HOP and ADAPT), RADIO_TICK_NS long ticks
+// Defaults to Timer1 with 256 prescaler, TCCR1B is set by RadioInitialize() in every mode.
+// Define both to use another timer, it has to be running before any of them is used
+#ifndef RADIO_TICKS
+#if defined(SIM_SPI) && SIM_SPI != 0
+#define RADIO_TICKS() ((uint16_t)(NrfSimMicros() >> 3))
+#define RADIO_TICK_NS 8000UL
+#else
+#define RADIO_TICKS() TCNT1
+#define RADIO_TICK_NS (256 * 1000000000ULL / F_CPU)
+#define RADIO_TIMER_START() TCCR1B = (1<<CS12)
+#endif
+#endif
+
+#ifndef RADIO_TIMER_START
+#define RADIO_TIMER_START()
+#endif
+
+// Microseconds to RADIO_TICKS(), rounded up
+#define RADIO_US_TO_TICKS(us) ((uint16_t)(((uint32_t)(us) * 1000UL + RADIO_TICK_NS - 1) / RADIO_TICK_NS))
+#define RADIO_TICKS_TO_US(ticks) ((uint32_t)((uint32_t)(ticks) * (uint32_t)RADIO_TICK_NS / 1000UL))
+
+//////////////////////////////////////////////////////////////////////////
+// TYPES
+//////////////////////////////////////////////////////////////////////////
+
+// Complete device configuration, applied with RadioCommitConfig()
+// Can be kept in flash (PROGMEM), see RadioCommitConfig_P()
+typedef struct
+{
+	uint8_t txAddress[5];		// TX_ADDR, TX_ADDRESS_LENGTH bytes used
+	uint8_t rxAddressP0[5];		// RX_ADDR_P0, RX_ADDRESS_LENGTH bytes used
+	uint8_t rxAddressP1[5];		// RX_ADDR_P1, RX_ADDRESS_LENGTH bytes used
+	uint8_t rxAddressLsb[4];	// RX_ADDR_P2..RX_ADDR_P5
+	uint8_t addressWidth;		// SETUP_AW, one of AW_BYTES_X
+	uint8_t enabledPipes;		// EN_RXADDR
+	uint8_t autoAck;			// EN_AA
+	uint8_t payloadWidth[6];	// RX_PW_P0..RX_PW_P5
+	uint8_t dynamicPayload;		// DYNPD
+	uint8_t feature;			// FEATURE
+	uint8_t config;				// CONFIG without PWR_UP and PRIM_RX (CRC and interrupt masks)
+	uint8_t retransmission;		// SETUP_RETR, ARD_US_XXXX | ARC_XX
+	uint8_t channel;			// RF_CH
+	uint8_t rfSetup;			// RF_SETUP, speed | power
+} RadioConfigImage;
+
+// Received payload, filled straight from the device
+typedef struct
+{
+	uint8_t length;
+	uint8_t pipe;
+	uint32_t timestamp;						// RADIO_TIMESTAMP() when the payload was read out
+	uint8_t data[MAXIMUM_PAYLOAD_SIZE + 1];	// NUL-terminated
+} RadioRxSlot;
+
 //////////////////////////////////////////////////////////////////////////
 // METHODS
 //////////////////////////////////////////////////////////////////////////
 void RadioInitialize(void);
-void RegisterRadioCallback(void (*callback)(uint8_t*, uint8_t));
+void RegisterRadioCallback(void (*callback)(uint8_t*, uint8_t, uint8_t));
+void RegisterPipeCallback(uint8_t dataPipe, void (*callback)(uint8_t*, uint8_t, uint8_t));
 void RadioInitialize(void);
 void RadioConfig(void);
 void RadioReadRegister(uint8_t reg, uint8_t* buffer, uint8_t len);
 uint8_t RadioReadRegisterSingle(uint8_t reg);
 void RadioWriteRegister(uint8_t reg, uint8_t* value, uint8_t len);
 void RadioWriteRegisterSingle(uint8_t reg, uint8_t value);
+uint8_t RadioReadShadow(uint8_t reg);
+uint8_t RadioGetStatus(void);
+uint8_t RadioNop(void);
+void RadioUpdateRegister(uint8_t reg, uint8_t value);
+void RadioUpdateAddress(uint8_t reg, const uint8_t* value);
+void RadioSyncRegisters(void);
+uint8_t RadioVerifyRegisters(void);
+void RadioRestoreRegisters(void);
+void RadioCommitConfig(const RadioConfigImage* image);
+void RadioCommitConfig_P(const RadioConfigImage* image);
 void RadioClearTX(void);
 void RadioClearRX(void);
 void RadioSetTransmitterAddress(const char* address);
@@ -48,6 +149,7 @@ uint8_t IsReceivedDataReady(void);
 uint8_t IsDataSentSuccessful(void);
 void RadioEnableCRC(void);
 void RadioSetCRCLength(uint8_t crcLength);
+uint8_t RadioIsReady(void);
 void RadioPowerUp(void);
 void RadioPowerDown(void);
 void RadioEnterTxMode(void);
@@ -64,22 +166,62 @@ void RadioConfigRetransmission(uint8_t time, uint8_t ammount);
 void RadioSetSpeed(uint8_t speed);
 void RadioSetPower(uint8_t power);
 void RadioSetDynamicPayload(uint8_t dataPipe, uint8_t onOff);
-void RadioLoadPayload(uint8_t* data, uint8_t length);
-void RadioSend(uint8_t* data);
+void RadioLoadPayload(const uint8_t* data, uint8_t length);
+void RadioLoadPayload_P(const uint8_t* data, uint8_t length);
+uint8_t RadioSend(uint8_t* data);
+uint8_t RadioSendBuffer(const uint8_t* data, uint8_t length);
+uint8_t RadioSendBuffer_P(const uint8_t* data, uint8_t length);
+uint8_t RadioSendBufferNoAck(const uint8_t* data, uint8_t length);
+uint8_t RadioSendResult(void);
+uint8_t RadioStreamBegin(uint8_t (*source)(uint8_t* buffer));
+void RadioStreamRefill(void);
+void RadioStreamEnd(void);
+uint16_t RadioStreamDropped(void);
+uint8_t RadioEnqueue(const uint8_t* data, uint8_t length);
+uint8_t RadioQueueCount(void);
+uint8_t RadioQueueHighWatermark(void);
+uint8_t RadioReadData(uint8_t* pipe);
+RadioRxSlot* RadioBorrowSlot(void);
+void RadioSetAckPayload(uint8_t onOff);
+uint8_t RadioQueueAckPayload(uint8_t dataPipe, const uint8_t* data, uint8_t length);
+uint8_t RadioUpdateAckPayload(uint8_t dataPipe, const uint8_t* data, uint8_t length);
+uint8_t RadioAckPayloadWaiting(uint8_t dataPipe);
+void RadioReleaseSlot(RadioRxSlot* slot);
+#if defined(SPI_ASYNC) && SPI_ASYNC != 0
+void RadioReadPayloadAsync(SpiJob* job, uint8_t* buffer, uint8_t length, void (*complete)(SpiJob*));
+#endif
 void RADIO_EVENT(void);
 void RadioPrintConfig(void(*printString)(char*), void(*printChar)(char), void(*printNumber)(int number, int raddix));
 //////////////////////////////////////////////////////////////////////////
 // Variables
 //////////////////////////////////////////////////////////////////////////
+extern const RadioConfigImage RadioDefaultConfig;
 
 //////////////////////////////////////////////////////////////////////////
 // HELPERS
 //////////////////////////////////////////////////////////////////////////
+#if defined(SIM_SPI) && SIM_SPI != 0
+// Host builds drive the simulated device's pins
+#define CE_LOW NrfSimSetCE(0)
+#define CE_HIGH NrfSimSetCE(1)
+
+#define CSN_PIN_LOW NrfSimSetCSN(0)
+#define CSN_PIN_HIGH NrfSimSetCSN(1)
+#else
 #define CE_LOW PORT(CE_PORT) &= ~(1<<CE)
 #define CE_HIGH PORT(CE_PORT) |= (1<<CE)
 
-#define CSN_LOW PORT(CSN_PORT) &= ~(1<<CSN)
-#define CSN_HIGH PORT(CSN_PORT) |= (1<<CSN)
+#define CSN_PIN_LOW PORT(CSN_PORT) &= ~(1<<CSN)
+#define CSN_PIN_HIGH PORT(CSN_PORT) |= (1<<CSN)
+#endif
+
+// Blocking transactions must wait for the queued asynchronous ones to finish
+#if defined(SPI_ASYNC) && SPI_ASYNC != 0
+#define CSN_LOW do { SpiWaitIdle(); CSN_PIN_LOW; } while (0)
+#else
+#define CSN_LOW CSN_PIN_LOW
+#endif
+#define CSN_HIGH CSN_PIN_HIGH
 
 #define DATA_RECEIVED_MASK (1<<RX_DR)
 #define DATA_SENT_MASK (1<<TX_DS)
@@ -92,17 +234,37 @@ void RadioPrintConfig(void(*printString)(char*), void(*printChar)(char), void(*p
 
 #define IRQ_CLEAR_MASK ((1<<MAX_RT) | (1<<TX_DS) | (1<<RX_DR))
 
+// Data pipe of RX FIFO head, taken from STATUS
+#define RX_PIPE(x)	 (((x) >> RX_P_NO) & 0x07)
+#define RX_FIFO_EMPTY 7
+
 #define POWER_DOWN	1
 #define STANDBY_1	2
 #define STANDBY_2	3
 #define RX_MODE		4
 #define TX_MODE		5
+#define SETTLING	6	// Waiting for the device to get to another state, see RADIO_NONBLOCKING
+
+// Returned by a stream source that has no more data
+#define STREAM_END 0xFF
+
+// RadioEnqueue() results
+#define QUEUE_FULL	0
+#define QUEUE_OK	1
+
+// RadioSendResult() values
+#define SEND_PENDING	0
+#define SEND_DONE		1	// TX_DS
+#define SEND_FAILED		2	// MAX_RT
 
 #define ROLE_TRANSMITTER 1
 #define ROLE_RECEIVER	 2
 
 #define INTERRUPTS_MASK	0x70
 
+// CONFIG..RF_SETUP, RX_ADDR_P2..P5, RX_PW_P0..P5, DYNPD and FEATURE
+#define SHADOW_SIZE 19
+
 //////////////////////////////////////////////////////////////////////////
 // COMPILE TIME ERROR CHECKS
 //////////////////////////////////////////////////////////////////////////
@@ -115,5 +277,22 @@ void RadioPrintConfig(void(*printString)(char*), void(*printChar)(char), void(*p
 #error "TX_ADDRESS_LENGTH must be between 3 and 5!"
 #endif
 
+#if (TX_QUEUE_SIZE < 1 || TX_QUEUE_SIZE > 255)
+#error "TX_QUEUE_SIZE must be between 1 and 255!"
+#endif
+
+#if (ACK_QUEUE_SIZE < 1 || ACK_QUEUE_SIZE > 255)
+#error "ACK_QUEUE_SIZE must be between 1 and 255!"
+#endif
+
+#if (RX_SLOT_COUNT < 1 || RX_SLOT_COUNT > 255)
+#error "RX_SLOT_COUNT must be between 1 and 255!"
+#endif
+
+// Start up (200ms) has to fit in half of RADIO_TICKS() range
+#if (RADIO_NONBLOCKING != 0 && 200000000ULL / RADIO_TICK_NS > 32767)
+#error "RADIO_TICKS() is too fast for RADIO_NONBLOCKING, use a bigger prescaler!"
+#endif
+
 
 #endif /* NRF24_H_ */
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <avr/interrupt.h>
 
 #include "NRF/nrf24.h"
+#include "NRF/SCAN/scan.h"
 #include "MK_USART/mkuart.h"
 
 char bufor[100];
@@ -20,7 +21,7 @@ char bufor[100];
 
 uint8_t role;
 
-void RadioDataReceived(uint8_t* data, uint8_t dataLength);
+void RadioDataReceived(uint8_t* data, uint8_t dataLength, uint8_t pipe);
 void UsartDataReceived(char* data);
 
 int main(void)
@@ -32,6 +33,13 @@ int main(void)
 	RadioInitialize();
 	RegisterRadioCallback(RadioDataReceived);
 	
+	// With RADIO_NONBLOCKING the device starts up in the background, UART works meanwhile
+	while (!RadioIsReady())
+	{
+		RADIO_EVENT();
+		UART_RX_STR_EVENT(bufor);
+	}
+	
 	role = RECEIVER;
 	RadioEnterRxMode();
 	RadioPrintConfig(uart_puts, uart_putc, uart_putint);
@@ -44,11 +52,13 @@ int main(void)
     }
 }
 
-void RadioDataReceived(uint8_t* data, uint8_t dataLength)
+void RadioDataReceived(uint8_t* data, uint8_t dataLength, uint8_t pipe)
 {
 	uart_puts("Received ");
 	uart_putint(dataLength, 10);
-	uart_puts(" bytes: ");
+	uart_puts(" bytes on pipe ");
+	uart_putint(pipe, 10);
+	uart_puts(": ");
 	uart_puts((char*)data);
 	uart_putc('\n');
 }
@@ -59,6 +69,16 @@ void UsartDataReceived(char* data)
 	{
 		RadioPrintConfig(uart_puts, uart_putc, uart_putint);
 	}
+	else if (strcmp(data, "scan") == 0)
+	{
+		// Receiver only, switches to the quietest channel
+		if (role == RECEIVER)
+		{
+			uart_puts("Channel ");
+			uart_putint(ScanSelectChannel(4), 10);
+			uart_puts(" is the quietest.\n");
+		}
+	}
 	else if(strcmp(data, "set rx") == 0)
 	{
 		role = RECEIVER;